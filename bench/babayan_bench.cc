@@ -0,0 +1,401 @@
+#include "babayan.hpp"
+
+#include <random>
+#include <sys/resource.h>
+
+/**
+ * Бенчмарки babayan.
+ *
+ * Генерирует детерминированные синтетические деревья файлов и меряет
+ * хэшеры, Keeper и полный прогон Scaner + Reader по фазам.
+ * Каждый результат - одна строка JSON в stdout.
+ *
+ *   babayan_bench [--root DIR] [--scale N] [--filter NAME] [--keep] [-- опции babayan]
+*/
+
+namespace fs = boost::filesystem;
+
+namespace bench {
+
+using steady = std::chrono::steady_clock;
+
+/**
+ * @brief Сбрасывает пиковый RSS процесса до текущего, чтобы мерить его по фазам
+*/
+inline void reset_peak_rss(){
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+/**
+ * @brief Пиковый размер резидентной памяти процесса с последнего reset_peak_rss, КиБ.
+ * Без /proc - пик за все время работы процесса
+*/
+inline long peak_rss_kb(){
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)){
+        if (line.compare(0, 6, "VmHWM:") == 0) return std::stol(line.substr(6));
+    }
+
+    struct rusage ru;
+    ::getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+inline double seconds_since(steady::time_point start){
+    return std::chrono::duration<double>(steady::now() - start).count();
+}
+
+/**
+ * @brief Строка результата в формате JSON
+*/
+class record {
+private:
+    std::ostringstream _out;
+    bool _first = true;
+
+    record& _key(const std::string& key){
+        _out << (_first ? "{" : ",") << '"' << key << "\":";
+        _first = false;
+        return *this;
+    }
+public:
+    record() {
+        _out.precision(15);
+    }
+
+    record& field(const std::string& key, const std::string& value){
+        _key(key)._out << '"' << value << '"';
+        return *this;
+    }
+
+    record& field(const std::string& key, double value){
+        _key(key)._out << value;
+        return *this;
+    }
+
+    void print(){
+        std::cout << _out.str() << "}" << std::endl;
+    }
+};
+
+/**
+ * @brief Детерминированный генератор синтетических деревьев файлов
+*/
+class generator {
+private:
+    fs::path _root;
+    std::mt19937_64 _rng;
+    std::uint64_t _files = 0;
+    std::uint64_t _bytes = 0;
+
+    /* Содержимое определяется только seed, поэтому одинаковый seed дает дубликат */
+    static std::string _content(std::uint64_t seed, std::size_t size){
+        std::mt19937_64 rng(seed);
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; i += 8){
+            std::uint64_t v = rng();
+            std::memcpy(&data[i], &v, std::min<std::size_t>(8, size - i));
+        }
+        return data;
+    }
+
+public:
+    explicit generator(const fs::path& root) : _root(root), _rng(20240501) {
+        fs::create_directories(root);
+    }
+
+    void write(const fs::path& rel, const std::string& data){
+        fs::path p = _root / rel;
+        fs::create_directories(p.parent_path());
+        std::ofstream(p.string(), std::ios::binary).write(data.data(), data.size());
+        _files++;
+        _bytes += data.size();
+    }
+
+    void write(const fs::path& rel, std::uint64_t seed, std::size_t size){
+        write(rel, _content(seed, size));
+    }
+
+    /**
+     * @brief Много мелких файлов разного размера, каждый десятый - дубликат
+    */
+    void small_files(std::size_t count){
+        for (std::size_t i = 0; i < count; i++){
+            std::size_t size = 512 + _rng() % 4096;
+            std::uint64_t seed = (i % 10 == 0) ? (i / 10) : (1000000 + i);
+            write(fs::path("small") / std::to_string(i % 64) / ("f" + std::to_string(i)), seed, size);
+        }
+    }
+
+    /**
+     * @brief Несколько огромных файлов, половина - дубликаты
+    */
+    void huge_files(std::size_t count, std::size_t size){
+        for (std::size_t i = 0; i < count; i++){
+            write(fs::path("huge") / ("h" + std::to_string(i)), 2000000 + i / 2, size);
+        }
+    }
+
+    /**
+     * @brief Большая группа файлов одинакового размера, пятая часть - пары дубликатов
+    */
+    void same_size(std::size_t count, std::size_t size){
+        for (std::size_t i = 0; i < count; i++){
+            std::uint64_t seed = (i % 5 == 0) ? (3000000 + i / 10) : (4000000 + i);
+            write(fs::path("same") / std::to_string(i % 32) / ("s" + std::to_string(i)), seed, size);
+        }
+    }
+
+    /**
+     * @brief Файлы, отличающиеся только последними байтами
+    */
+    void trailers(std::size_t count, std::size_t size){
+        std::string base = _content(5000000, size);
+        for (std::size_t i = 0; i < count; i++){
+            std::string data = base;
+            std::string tail = std::to_string(i);
+            std::memcpy(&data[size - tail.size()], tail.data(), tail.size());
+            write(fs::path("trailer") / ("t" + std::to_string(i)), data);
+        }
+    }
+
+    /**
+     * @brief Глубоко вложенные директории с файлом на каждом уровне
+    */
+    void deep(std::size_t depth, std::size_t width){
+        for (std::size_t w = 0; w < width; w++){
+            fs::path dir = fs::path("deep") / ("w" + std::to_string(w));
+            for (std::size_t d = 0; d < depth; d++){
+                dir /= "d" + std::to_string(d);
+                write(dir / "file", 6000000 + d, 1024 + d);
+            }
+        }
+    }
+
+    std::uint64_t files() const { return _files; }
+    std::uint64_t bytes() const { return _bytes; }
+};
+
+/**
+ * @brief Скорость хэшера на буфере в памяти
+*/
+inline void bench_hasher(const std::string& name, std::size_t block){
+    const std::size_t total = 256 << 20;
+    std::string data(block, '\0');
+    std::mt19937_64 rng(1);
+    for (auto& c : data) c = static_cast<char>(rng());
+
+    auto hasher = make_hasher(name);
+    auto start = steady::now();
+    for (std::size_t done = 0; done < total; done += block){
+        hasher->next_hash(data.data(), block);
+    }
+    double sec = seconds_since(start);
+
+    record().field("bench", "hasher").field("name", name).field("block", block)
+        .field("seconds", sec).field("mb_per_s", total / sec / 1e6).print();
+}
+
+/**
+ * @brief Вставка в хранилище файлов и группировка по размеру
+ * @arg store Хранилище: flat или index
+*/
+inline void bench_keeper(const std::string& store, std::size_t count){
+    std::mt19937_64 rng(2);
+    std::vector<file_entry> entries;
+    entries.reserve(count);
+    for (std::size_t i = 0; i < count; i++){
+        entries.emplace_back(fs::path("/bench/dir" + std::to_string(i % 1000)) / ("file" + std::to_string(i)), rng() % 100000);
+    }
+
+    config::Config::instance().store = store;
+    std::shared_ptr<IKeeper> keeper = make_keeper();
+    reset_peak_rss();
+    long base_rss = peak_rss_kb();
+    auto start = steady::now();
+    keeper->add_files(entries);
+    double insert = seconds_since(start);
+
+    start = steady::now();
+    std::size_t groups = 0;
+    /* Как в Reader: файлы выдаются только для групп из двух и более файлов */
+    for (auto g : keeper->group_by_size(2)){
+        (void)g;
+        groups++;
+    }
+    double group = seconds_since(start);
+
+    record().field("bench", "keeper").field("store", store).field("files", count).field("groups", groups)
+        .field("insert_files_per_s", count / insert).field("group_files_per_s", count / group)
+        .field("peak_rss_kb", peak_rss_kb()).field("rss_growth_kb", peak_rss_kb() - base_rss).print();
+}
+
+/**
+ * @brief Поток вывода, выбрасывающий все данные
+*/
+class null_buffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+/**
+ * @brief Получатель, складывающий найденные группы, чтобы вывести их отдельной фазой
+*/
+class group_collector : public group_sink {
+private:
+    std::mutex _mutex;
+public:
+    std::vector<std::unique_ptr<dup_group>> groups;
+
+    void push(std::unique_ptr<dup_group> g) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        groups.push_back(std::move(g));
+    }
+};
+
+/**
+ * @brief Полный прогон Scaner + Reader по дереву сценария.
+ * Фазы: scan - обход дерева, group - группировка по размеру,
+ * hash - сравнение содержимого (включает свою группировку), output - форматирование групп
+ * @arg args Опции babayan, переданные после --
+*/
+inline void bench_e2e(const std::string& scenario, const fs::path& root,
+    std::uint64_t files, std::uint64_t bytes, const std::vector<std::string>& args)
+{
+    std::vector<std::string> argv_s = {"babayan", "--include", root.string(), "--recursive", "1"};
+    argv_s.insert(argv_s.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (auto& a : argv_s) argv.push_back(a.data());
+
+    config::Config::instance().includes.clear();
+    config::parse_app_arguments(static_cast<int>(argv.size()), argv.data());
+
+    std::shared_ptr<IKeeper> keeper = make_keeper();
+    auto phase = [&](const std::string& name, double sec){
+        record r;
+        r.field("bench", "e2e").field("scenario", scenario).field("phase", name)
+            .field("seconds", sec).field("files_per_s", files / sec);
+        if (name == "hash") r.field("mb_per_s", bytes / sec / 1e6);
+        r.field("peak_rss_kb", peak_rss_kb()).print();
+    };
+
+    reset_peak_rss();
+    auto start = steady::now();
+    Scaner scaner(keeper);
+    scaner.collect();
+    phase("scan", seconds_since(start));
+
+    reset_peak_rss();
+    start = steady::now();
+    /* Как в Reader: файлы выдаются только для групп из двух и более файлов */
+    for (auto g : keeper->group_by_size(2)){
+        (void)g;
+    }
+    phase("group", seconds_since(start));
+
+    group_collector found;
+    reset_peak_rss();
+    start = steady::now();
+    Reader reader;
+    reader.process(keeper, found);
+    phase("hash", seconds_since(start));
+
+    null_buffer devnull;
+    std::ostream out(&devnull);
+    reset_peak_rss();
+    start = steady::now();
+    {
+        result_writer writer(out, config::Config::instance().format);
+        for (auto& g : found.groups){
+            writer.push(std::move(g));
+        }
+    }
+    phase("output", seconds_since(start));
+}
+
+} // namespace bench
+
+int main(int argc, char *argv[]){
+    namespace po = boost::program_options;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help", "This screen")
+        ("root", po::value<std::string>(), "Directory for synthetic trees (temporary by default)")
+        ("scale", po::value<std::size_t>()->default_value(1), "Multiplier of the amount of generated data")
+        ("filter", po::value<std::string>()->default_value(""), "Run only benchmarks whose name contains this string")
+        ("keep", "Do not remove generated trees");
+
+    /* Все после -- передается парсеру опций babayan */
+    std::vector<std::string> forwarded;
+    int own = argc;
+    for (int i = 1; i < argc; i++){
+        if (std::strcmp(argv[i], "--") == 0){
+            own = i;
+            forwarded.assign(argv + i + 1, argv + argc);
+            break;
+        }
+    }
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(own, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")){
+        std::cout << desc << '\n';
+        return EXIT_SUCCESS;
+    }
+
+    std::size_t scale  = vm["scale"].as<std::size_t>();
+    std::string filter = vm["filter"].as<std::string>();
+    auto enabled = [&](const std::string& name){
+        return filter.empty() || name.find(filter) != std::string::npos;
+    };
+
+    fs::path root = vm.count("root") ? fs::path(vm["root"].as<std::string>())
+        : fs::temp_directory_path() / fs::unique_path("babayan-bench-%%%%-%%%%");
+
+    for (const auto& name : hasher_names()){
+        if (enabled("hasher_" + name)){
+            bench::bench_hasher(name, 4096);
+            bench::bench_hasher(name, 1 << 20);
+        }
+    }
+
+    for (const std::string store : {"flat", "index"}){
+        if (enabled("keeper_" + store)){
+            bench::bench_keeper(store, 200000 * scale);
+        }
+    }
+
+    /* Сценарии полного прогона: имя и заполнение дерева */
+    std::vector<std::pair<std::string, std::function<void(bench::generator&)>>> scenarios = {
+        {"small",   [&](bench::generator& g){ g.small_files(20000 * scale); }},
+        {"huge",    [&](bench::generator& g){ g.huge_files(4, (64 << 20) * scale); }},
+        {"same",    [&](bench::generator& g){ g.same_size(5000 * scale, 16384); }},
+        {"trailer", [&](bench::generator& g){ g.trailers(200 * scale, 1 << 20); }},
+        {"deep",    [&](bench::generator& g){ g.deep(64, 16 * scale); }},
+    };
+
+    for (auto& [name, fill] : scenarios){
+        if (!enabled("e2e_" + name)) continue;
+
+        fs::path dir = root / name;
+        auto start = bench::steady::now();
+        bench::generator gen(dir);
+        fill(gen);
+        bench::record().field("bench", "generate").field("scenario", name)
+            .field("files", gen.files()).field("bytes", gen.bytes())
+            .field("seconds", bench::seconds_since(start)).print();
+
+        bench::bench_e2e(name, dir, gen.files(), gen.bytes(), forwarded);
+    }
+
+    if (!vm.count("keep")){
+        fs::remove_all(root);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Удаление объекта, размещенного в арене: только вызов деструктора,
+ * память освобождается вместе со всей ареной
+*/
+struct arena_destroy {
+    template<typename T>
+    void operator()(T* p) const {
+        std::destroy_at(p);
+    }
+};
+
+template<typename T>
+using arena_ptr = std::unique_ptr<T, arena_destroy>;
+
+/**
+ * @brief Арена текущего потока для объектов одной группы файлов.
+ * Память выделяется монотонно из буфера потока и целиком возвращается,
+ * когда обработка группы заканчивается. Вложенные арены потока
+ * используют ту же память, сброс - при завершении внешней
+*/
+class group_arena {
+private:
+    /* Начальный буфер арены потока. Большие группы добирают память у new/delete */
+    static constexpr std::size_t _initial = 256 << 10;
+
+    struct state {
+        std::unique_ptr<std::byte[]> buffer{new std::byte[_initial]};
+        std::pmr::monotonic_buffer_resource resource{buffer.get(), _initial, std::pmr::new_delete_resource()};
+        unsigned depth = 0;
+    };
+
+    static state& _local(){
+        thread_local state s;
+        return s;
+    }
+
+    state& _state;
+public:
+    group_arena() : _state(_local()) {
+        _state.depth++;
+    }
+
+    ~group_arena() {
+        if (--_state.depth == 0) _state.resource.release();
+    }
+
+    group_arena(const group_arena&) = delete;
+
+    std::pmr::memory_resource* resource(){
+        return &_state.resource;
+    }
+
+    void* allocate(std::size_t size, std::size_t align){
+        return _state.resource.allocate(size, align);
+    }
+
+    template<typename T, typename... Args>
+    arena_ptr<T> make(Args&&... args){
+        void* where = allocate(sizeof(T), alignof(T));
+        return arena_ptr<T>(new (where) T(std::forward<Args>(args)...));
+    }
+};
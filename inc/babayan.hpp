@@ -8,6 +8,62 @@
 #include <memory>
 #include <fstream>
 #include <typeinfo>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <latch>
+#include <span>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <tuple>
+#include <compare>
+#include <cstdint>
+#include <cstdlib>
+#include <system_error>
+#include <map>
+#include <bit>
+#include <ctime>
+#include <sstream>
+#include <iomanip>
+#include <condition_variable>
+#include <limits>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <queue>
+#include <memory_resource>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <csignal>
+
+#include <linux/io_uring.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#endif
+#include <sys/resource.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -23,11 +79,25 @@
 #include <boost/crc.hpp>
 #include <boost/uuid/detail/md5.hpp>
 
+#ifdef BABAYAN_WITH_XXHASH
+#ifdef BABAYAN_XXHASH_DISPATCH
+#include <xxh_x86dispatch.h>
+#else
+#include <xxhash.h>
+#endif
+#endif
+
+#ifdef BABAYAN_WITH_BLAKE3
+#include <blake3.h>
+#endif
+
 #include <boost/program_options.hpp>
 #include <boost/tokenizer.hpp>
 
 #include <boost/coroutine2/all.hpp>
 
+#include <boost/lockfree/queue.hpp>
+
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/composite_key.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -37,8 +107,19 @@
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#include "hasher.h"
 #include "config.h"
+#include "stats.h"
+#include "arena.h"
+#include "device.h"
 #include "keeper.h"
-#include "hasher.h"
+#include "source.h"
+#include "spill.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "writer.h"
 #include "reader.h"
+#include "filter.h"
 #include "scaner.h"
+#include "watch.h"
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Запись постоянного кэша хэшей.
+ * Запись действительна, пока у файла (dev, ino) не изменились
+ * размер, mtime и ctime, а хэш посчитан тем же алгоритмом и расписанием блоков.
+ * Кроме хэша всего файла хранятся хэши его начала и подпись по выборкам:
+ * с ними новые файлы сравниваются с файлом из кэша, не дочитывая себя до конца.
+ * Файл, отсеянный до конца чтения, хранится частичной записью - без хэша
+ * всего файла, только с подписью и хэшами начала, до которых он был прочитан
+*/
+struct cache_record {
+    /* Хэши начала файла после 1, 2, 4, ... блоков */
+    static constexpr unsigned prefixes = 4;
+    /* Флаги записи */
+    static constexpr std::uint32_t has_signature = 1;
+    static constexpr std::uint32_t has_digest    = 2;
+
+    std::uint64_t dev;
+    std::uint64_t ino;
+    std::uint64_t size;
+    /* Время модификации данных, нс */
+    std::int64_t  mtime;
+    /* Время изменения inode, нс */
+    std::int64_t  ctime;
+    /* Идентификатор алгоритма хэширования */
+    std::uint32_t algo;
+    /* Расписание блоков, которым считался хэш: начальный и наибольший размер, рост */
+    std::uint32_t block;
+    std::uint32_t block_max;
+    std::uint32_t block_growth;
+    std::uint32_t flags;
+    /* Параметры выборок, по которым посчитана подпись */
+    std::uint32_t sample;
+    std::uint32_t samples;
+    /* Кол-во посчитанных хэшей начала: prefix[i] есть для i < depth */
+    std::uint32_t depth;
+    /* Хэш всего файла, если флаг has_digest */
+    digest_t digest;
+    /* Подпись файла по выборкам, если флаг has_signature */
+    digest_t signature;
+    /* Хэш начала файла после 2^i блоков */
+    digest_t prefix[prefixes];
+
+    /* Порядок записей в файле кэша */
+    static bool less(const cache_record& a, const cache_record& b){
+        return std::tie(a.dev, a.ino, a.algo, a.block, a.block_max, a.block_growth) <
+            std::tie(b.dev, b.ino, b.algo, b.block, b.block_max, b.block_growth);
+    }
+
+    static bool same_key(const cache_record& a, const cache_record& b){
+        return std::tie(a.dev, a.ino, a.algo, a.block, a.block_max, a.block_growth) ==
+            std::tie(b.dev, b.ino, b.algo, b.block, b.block_max, b.block_growth);
+    }
+
+    /**
+     * @brief Заготовка записи для файла с текущими параметрами хэширования
+    */
+    static cache_record from_stat(const struct stat& st){
+        cache_record r{};
+        r.dev   = st.st_dev;
+        r.ino   = st.st_ino;
+        r.size  = st.st_size;
+        r.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        r.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+        r.algo  = algo_id(config::Config::instance().hash);
+        const auto& conf = config::Config::instance();
+        r.block        = static_cast<std::uint32_t>(conf.block);
+        r.block_max    = static_cast<std::uint32_t>(std::max(conf.block, conf.block_max));
+        r.block_growth = static_cast<std::uint32_t>(std::max<std::size_t>(conf.block_growth, 1));
+        r.sample       = static_cast<std::uint32_t>(conf.sample);
+        r.samples      = static_cast<std::uint32_t>(conf.samples);
+        return r;
+    }
+
+    /**
+     * @brief Подпись записи посчитана с текущими параметрами выборок
+    */
+    bool signed_as(const cache_record& key) const {
+        return (flags & has_signature) && sample == key.sample && samples == key.samples;
+    }
+
+    /**
+     * @brief Идентификатор алгоритма хэширования - FNV-1a от его имени
+    */
+    static std::uint32_t algo_id(const std::string& name){
+        std::uint32_t h = 2166136261u;
+        for (unsigned char c : name){
+            h = (h ^ c) * 16777619u;
+        }
+        return h;
+    }
+};
+
+/**
+ * @brief Постоянный кэш хэшей файлов между запусками.
+ * Файл кэша - заголовок и отсортированный массив cache_record,
+ * который отображается в память целиком без разбора
+*/
+class hash_cache {
+private:
+    struct header {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t record_size;
+        std::uint64_t count;
+    };
+
+    static constexpr char _magic[8] = {'B', 'A', 'B', 'A', 'Y', 'A', 'N', 'C'};
+    static constexpr std::uint32_t _version = 5;
+
+    boost::filesystem::path _path;
+    std::unique_ptr<boost::interprocess::mapped_region> _region;
+    const cache_record* _begin = nullptr;
+    const cache_record* _end   = nullptr;
+
+    /* Записи, посчитанные в этом запуске */
+    std::vector<cache_record> _fresh;
+    /* Режим наблюдения: последние записи каждого файла (dev, ino) доступны для поиска */
+    bool _live = false;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, cache_record> _recent;
+    mutable std::mutex _mutex;
+
+    hash_cache() = default;
+
+    /* Запись все еще описывает файл key */
+    static bool _valid(const cache_record& record, const cache_record& key){
+        return record.size == key.size && record.mtime == key.mtime && record.ctime == key.ctime;
+    }
+public:
+    hash_cache(const hash_cache&) = delete;
+
+    static hash_cache& instance(){
+        static hash_cache cache;
+        return cache;
+    }
+
+    bool enabled() const {
+        return !_path.empty() || _live;
+    }
+
+    /**
+     * @brief Включает поиск по хэшам, посчитанным в этом запуске.
+     * Нужно режиму наблюдения: при повторном сравнении группы
+     * перечитываются только изменившиеся файлы
+    */
+    void live(bool on = true){
+        _live = on;
+    }
+
+    /**
+     * @brief Открывает файл кэша. Отсутствующий или несовместимый файл
+     * означает пустой кэш, он будет перезаписан при save()
+    */
+    void load(const boost::filesystem::path& path){
+        _path = path;
+        _fresh.clear();
+        _region.reset();
+        _begin = _end = nullptr;
+
+        boost::system::error_code ec;
+        if (boost::filesystem::file_size(path, ec) < sizeof(header) || ec) return;
+
+        boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+        _region = std::make_unique<boost::interprocess::mapped_region>(mapping, boost::interprocess::read_only);
+
+        auto h = static_cast<const header*>(_region->get_address());
+        if (std::memcmp(h->magic, _magic, sizeof(_magic)) != 0 || h->version != _version ||
+            h->record_size != sizeof(cache_record) ||
+            h->count > (_region->get_size() - sizeof(header)) / sizeof(cache_record))
+        {
+            std::cerr << "Файл кэша " << path << " несовместим и будет перезаписан" << std::endl;
+            _region.reset();
+            return;
+        }
+
+        _begin = reinterpret_cast<const cache_record*>(h + 1);
+        _end   = _begin + h->count;
+    }
+
+    /**
+     * @brief Ищет запись файла в кэше
+     * @arg key Заготовка записи, полученная из cache_record::from_stat
+     * @arg found Куда записать найденную запись
+     * @return true, если файл не изменился с момента расчета хэша
+    */
+    bool lookup(const cache_record& key, cache_record& found) const {
+        if (_live){
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _recent.find({key.dev, key.ino});
+            if (it != _recent.end() && _valid(it->second, key)){
+                found = it->second;
+                return true;
+            }
+        }
+
+        auto it = std::lower_bound(_begin, _end, key, cache_record::less);
+        if (it == _end || !cache_record::same_key(*it, key) || !_valid(*it, key)) return false;
+
+        found = *it;
+        return true;
+    }
+
+    /**
+     * @brief Запоминает запись файла, полную или частичную. Потокобезопасно
+    */
+    void store(const cache_record& record){
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_live) _recent[{record.dev, record.ino}] = record;
+        if (!_path.empty()) _fresh.push_back(record);
+    }
+
+    /**
+     * @brief Сливает старые и новые записи и атомарно заменяет файл кэша
+    */
+    void save(){
+        if (_path.empty()) return;
+
+        std::stable_sort(_fresh.begin(), _fresh.end(), cache_record::less);
+
+        std::vector<cache_record> merged;
+        merged.reserve((_end - _begin) + _fresh.size());
+        auto old = _begin;
+        for (auto it = _fresh.begin(); it != _fresh.end(); it++){
+            /* Из повторов по ключу остается последняя запись */
+            if (it + 1 != _fresh.end() && cache_record::same_key(*it, *(it + 1))) continue;
+
+            while (old != _end && cache_record::less(*old, *it)) merged.push_back(*old++);
+            if (old != _end && cache_record::same_key(*old, *it)) old++;
+            merged.push_back(*it);
+        }
+        merged.insert(merged.end(), old, _end);
+
+        header h{};
+        std::memcpy(h.magic, _magic, sizeof(_magic));
+        h.version     = _version;
+        h.record_size = sizeof(cache_record);
+        h.count       = merged.size();
+
+        boost::filesystem::path tmp = _path;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp.string(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(merged.data()), merged.size() * sizeof(cache_record));
+            if (!out){
+                std::cerr << "Не удалось записать файл кэша " << tmp << std::endl;
+                throw std::exception();
+            }
+        }
+        boost::filesystem::rename(tmp, _path);
+    }
+};
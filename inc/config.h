@@ -23,12 +23,50 @@ public:
     std::size_t minfile;
     /** @brief Маски имен файлов разрешенных для сканирования */
     std::set<std::string> masks;
-    /** @brief Размер блоков (в байтах) для чтения файлов */
+    /** @brief Размер первого блока (в байтах) для чтения файлов */
     std::size_t block;
+    /** @brief Наибольший размер блока (в байтах) */
+    std::size_t block_max;
+    /** @brief Во сколько раз растет каждый следующий блок, 1 - блоки одного размера */
+    std::size_t block_growth;
     /** @brief Алгоритм расчета хэша */
     std::string hash;
     /** @brief Кол-во потоков при поиске дубликатов */
     std::size_t threads;
+    /** @brief Кол-во групп одного вращающегося диска, читаемых одновременно */
+    std::size_t hdd_threads = 1;
+    /** @brief Кол-во групп одного твердотельного устройства, читаемых одновременно, 0 - threads */
+    std::size_t ssd_threads = 0;
+    /** @brief Способ чтения файлов (mmap, pread, uring) */
+    std::string reader;
+    /** @brief Обращение со страничным кэшем при чтении (sequential, dontneed, direct) */
+    std::string cache_policy = "sequential";
+    /** @brief Вывод путей к одному inode (merge, separate, ignore) */
+    std::string hardlinks = "merge";
+    /** @brief Не читать дыры разреженных файлов (SEEK_DATA/SEEK_HOLE) */
+    bool sparse = true;
+    /** @brief Способ сравнения файлов (hash, bytes, auto) */
+    std::string compare;
+    /** @brief Размер выборки (в байтах) для подписи файла, 0 - без подписи */
+    std::size_t sample;
+    /** @brief Кол-во выборок из середины файла для подписи */
+    std::size_t samples;
+    /** @brief Путь к постоянному кэшу хэшей, пустой - кэш не используется */
+    std::string cache;
+    /** @brief Лимит памяти (в МиБ) под список файлов, 0 - без лимита */
+    std::size_t memory_limit = 0;
+    /** @brief Считать подписи файлов заранее, пока идет сканирование */
+    bool pipeline = false;
+    /** @brief Хранилище отобранных файлов (flat, index) */
+    std::string store = "flat";
+    /** @brief Формат вывода групп дубликатов (text, nul, jsonl) */
+    std::string format = "text";
+    /** @brief Куда вывести статистику запуска в JSON: путь, "-" - stderr, пустой - не выводить */
+    std::string stats;
+    /** @brief Период (в секундах) вывода прогресса в stderr, 0 - не выводить */
+    std::size_t progress = 0;
+    /** @brief После первого прохода следить за изменениями файлов */
+    bool watch = false;
 
     Config(const Config&) = delete;
     Config(const Config&&) = delete;
@@ -77,12 +115,31 @@ void set_masks(const std::string& val){
     _parse_mask(val, Config::instance().masks);
 }
 void set_block(const std::size_t& val){
+    if (val == 0){
+        std::cerr << "Размер блока должен быть больше нуля" << std::endl;
+        throw std::exception();
+    }
+
     Config::instance().block = val;
 }
 
+void set_block_max(const std::size_t& val){
+    Config::instance().block_max = val;
+}
+
+void set_block_growth(const std::size_t& val){
+    if (val == 0){
+        std::cerr << "Рост блока должен быть не меньше 1" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().block_growth = val;
+}
+
 void set_hash(const std::string& val){
-    if ((val != "crc32") && (val != "md5")){
-        std::cout << "Неверно задан алгоритм хэширования" << std::endl;
+    const auto& names = hasher_names();
+    if (std::find(names.begin(), names.end(), val) == names.end()){
+        std::cerr << "Неверно задан алгоритм хэширования" << std::endl;
         throw std::exception();
     }
 
@@ -93,6 +150,104 @@ void set_threads(const std::size_t& val){
     Config::instance().threads = val;
 }
 
+void set_hdd_threads(const std::size_t& val){
+    Config::instance().hdd_threads = val;
+}
+
+void set_ssd_threads(const std::size_t& val){
+    Config::instance().ssd_threads = val;
+}
+
+void set_reader(const std::string& val){
+    if ((val != "mmap") && (val != "pread") && (val != "uring")){
+        std::cerr << "Неверно задан способ чтения файлов" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().reader = val;
+}
+
+void set_cache_policy(const std::string& val){
+    if ((val != "sequential") && (val != "dontneed") && (val != "direct")){
+        std::cerr << "Неверно задана политика страничного кэша" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().cache_policy = val;
+}
+
+void set_hardlinks(const std::string& val){
+    if ((val != "merge") && (val != "separate") && (val != "ignore")){
+        std::cerr << "Неверно задан вывод жестких ссылок" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().hardlinks = val;
+}
+
+void set_sparse(const bool& val){
+    Config::instance().sparse = val;
+}
+
+void set_compare(const std::string& val){
+    if ((val != "hash") && (val != "bytes") && (val != "auto")){
+        std::cerr << "Неверно задан способ сравнения файлов" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().compare = val;
+}
+
+void set_sample(const std::size_t& val){
+    Config::instance().sample = val;
+}
+
+void set_samples(const std::size_t& val){
+    Config::instance().samples = val;
+}
+
+void set_cache(const std::string& val){
+    Config::instance().cache = val;
+}
+
+void set_memory_limit(const std::size_t& val){
+    Config::instance().memory_limit = val;
+}
+
+void set_pipeline(const bool& val){
+    Config::instance().pipeline = val;
+}
+
+void set_store(const std::string& val){
+    if ((val != "flat") && (val != "index")){
+        std::cerr << "Неверно задано хранилище файлов" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().store = val;
+}
+
+void set_format(const std::string& val){
+    if ((val != "text") && (val != "nul") && (val != "jsonl")){
+        std::cerr << "Неверно задан формат вывода" << std::endl;
+        throw std::exception();
+    }
+
+    Config::instance().format = val;
+}
+
+void set_stats(const std::string& val){
+    Config::instance().stats = val;
+}
+
+void set_progress(const std::size_t& val){
+    Config::instance().progress = val;
+}
+
+void set_watch(const bool& val){
+    Config::instance().watch = val;
+}
+
 auto parse_app_arguments(int argc, char *argv[]){
         namespace po = boost::program_options;
         
@@ -108,7 +263,7 @@ auto parse_app_arguments(int argc, char *argv[]){
             (
                 "exclude, e",
                 po::value<std::string>()->notifier(config::set_exclude_dirs),
-                "Directories for excluding from scaning"
+                "Directories for excluding from scaning: names or glob patterns (*, ?, [...]) of directories; containing '/' - paths (with subtrees) or path patterns"
             )
             (
                 "recursive, r",
@@ -123,22 +278,117 @@ auto parse_app_arguments(int argc, char *argv[]){
             (
                 "masks, m",
                 po::value<std::string>()->notifier(config::set_masks),
-                "Masks of names of files that included to scan. Register undepended."
+                "Masks of names of files that included to scan: substrings or glob patterns (*, ?, [...]). Register undepended."
             )
             (
                 "block, b",
-                po::value<std::size_t>()->default_value(1024)->notifier(config::set_block),
-                "Size [bytes] of block for reading files"
+                po::value<std::size_t>()->default_value(4096)->notifier(config::set_block),
+                "Size [bytes] of the first block for reading files"
+            )
+            (
+                "block-max",
+                po::value<std::size_t>()->default_value(16 << 20)->notifier(config::set_block_max),
+                "Maximum size [bytes] of block"
+            )
+            (
+                "block-growth",
+                po::value<std::size_t>()->default_value(16)->notifier(config::set_block_growth),
+                "Growth factor of block size while files keep matching (1 - fixed blocks)"
             )
             (
                 "hash, a",
-                po::value<std::string>()->default_value("crc32")->notifier(config::set_hash),
-                "Algorithm for hash (crc32, md5)"
+                po::value<std::string>()->default_value(default_hasher)->notifier(config::set_hash),
+                ("Algorithm for hash (" + boost::algorithm::join(hasher_names(), ", ") + ")").c_str()
             )
             (
                 "threads, t",
                 po::value<std::size_t>()->default_value(16)->notifier(config::set_threads),
                 "Amount of threads"
+            )
+            (
+                "hdd-threads",
+                po::value<std::size_t>()->default_value(1)->notifier(config::set_hdd_threads),
+                "Groups read at once from one rotational disk; its files are read in physical order (0 - threads)"
+            )
+            (
+                "ssd-threads",
+                po::value<std::size_t>()->default_value(0)->notifier(config::set_ssd_threads),
+                "Groups read at once from one solid-state or non-block device (0 - threads)"
+            )
+            (
+                "reader",
+                po::value<std::string>()->default_value("mmap")->notifier(config::set_reader),
+                "Backend for reading files (mmap, pread, uring)"
+            )
+            (
+                "cache-policy",
+                po::value<std::string>()->default_value("sequential")->notifier(config::set_cache_policy),
+                "Page cache use: sequential (readahead hints), dontneed (drop pages after reading) or direct (O_DIRECT, implies pread)"
+            )
+            (
+                "hardlinks",
+                po::value<std::string>()->default_value("merge")->notifier(config::set_hardlinks),
+                "Paths to one inode are read once and reported: merge (inside duplicate groups), separate (as own \"hardlinked\" groups) or ignore"
+            )
+            (
+                "sparse",
+                po::value<bool>()->default_value(true)->notifier(config::set_sparse),
+                "Find holes of sparse files (SEEK_DATA/SEEK_HOLE) and hash them as zeros without reading"
+            )
+            (
+                "compare",
+                po::value<std::string>()->default_value("auto")->notifier(config::set_compare),
+                "Comparison of files: hash, bytes or auto (bytes for groups up to 8 files unless digests are needed for jsonl, --cache or --watch)"
+            )
+            (
+                "sample",
+                po::value<std::size_t>()->default_value(4096)->notifier(config::set_sample),
+                "Size [bytes] of head and tail samples compared before full comparison (0 - off)"
+            )
+            (
+                "samples",
+                po::value<std::size_t>()->default_value(0)->notifier(config::set_samples),
+                "Amount of additional samples from the middle of files"
+            )
+            (
+                "cache",
+                po::value<std::string>()->notifier(config::set_cache),
+                "Path to persistent hash cache. Unchanged files are not reread"
+            )
+            (
+                "memory-limit",
+                po::value<std::size_t>()->default_value(0)->notifier(config::set_memory_limit),
+                "Memory limit [MiB]. Half of it holds the file list, the rest spills to sorted temporary files (0 - no limit)"
+            )
+            (
+                "pipeline",
+                po::value<bool>()->default_value(false)->notifier(config::set_pipeline),
+                "Compute sample signatures of files while scanning is still in progress"
+            )
+            (
+                "store",
+                po::value<std::string>()->default_value("flat")->notifier(config::set_store),
+                "Storage of scanned files: flat (compact, interned paths) or index (multi_index container)"
+            )
+            (
+                "format",
+                po::value<std::string>()->default_value("text")->notifier(config::set_format),
+                "Output format: text, nul (NUL-delimited paths, empty path ends a group) or jsonl (size, digest and files)"
+            )
+            (
+                "stats",
+                po::value<std::string>()->implicit_value("-")->notifier(config::set_stats),
+                "Print run statistics as JSON when finished: to the file or to stderr without value"
+            )
+            (
+                "progress",
+                po::value<std::size_t>()->default_value(0)->notifier(config::set_progress),
+                "Period [seconds] of progress line with ETA on stderr (0 - off)"
+            )
+            (
+                "watch",
+                po::value<bool>()->default_value(false)->notifier(config::set_watch),
+                "Keep running after the first pass and report added and removed duplicate groups as files change"
             );
 
         std::shared_ptr<po::variables_map> vm = std::make_shared<po::variables_map>();
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Блочное устройство, на котором лежат файлы.
+ * Группы файлов одного устройства читаются не более чем limit потоками
+*/
+struct io_device {
+    dev_t dev;
+    /* Вращающийся диск: чтение упорядочивается по физическому расположению файлов */
+    bool rotational;
+    /* Кол-во групп устройства, обрабатываемых одновременно */
+    std::size_t limit;
+};
+
+/**
+ * @brief Устройства файлов, определенные по st_dev.
+ * Тип устройства читается из sysfs один раз на устройство
+*/
+class device_table {
+private:
+    std::mutex _mutex;
+    std::unordered_map<dev_t, std::unique_ptr<io_device>> _devices;
+
+    device_table() = default;
+
+    /**
+     * @brief Признак rotational очереди устройства. У раздела
+     * очереди нет, она берется у диска, которому раздел принадлежит
+     * @return false, если устройство не блочное (tmpfs, сетевые ФС) или sysfs недоступен
+    */
+    static bool _rotational(dev_t dev){
+        const std::string base = "/sys/dev/block/" + std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+        for (const char* queue : {"/queue/rotational", "/../queue/rotational"}){
+            std::ifstream in(base + queue);
+            int value;
+            if (in >> value) return value != 0;
+        }
+        return false;
+    }
+
+public:
+    device_table(const device_table&) = delete;
+
+    static device_table& instance(){
+        static device_table table;
+        return table;
+    }
+
+    /**
+     * @brief Устройство по номеру st_dev
+    */
+    const io_device& of(dev_t dev){
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& device = _devices[dev];
+        if (!device){
+            const auto& conf = config::Config::instance();
+            bool rotational = _rotational(dev);
+            std::size_t limit = rotational ? conf.hdd_threads : conf.ssd_threads;
+            if (limit == 0) limit = conf.threads;
+            device = std::make_unique<io_device>(io_device{dev, rotational, std::max<std::size_t>(limit, 1)});
+        }
+        return *device;
+    }
+
+    /**
+     * @brief Устройство, на котором лежит файл. Файл, который не удалось
+     * открыть, относится к устройству 0 - его ошибку сообщит Reader
+    */
+    const io_device& of_file(const boost::filesystem::path& file){
+        struct stat st;
+        return of(::stat(file.c_str(), &st) == 0 ? st.st_dev : 0);
+    }
+
+    /**
+     * @brief Устройство группы файлов. Группа, часть файлов которой лежит
+     * на вращающемся диске, относится к нему: параллельное чтение
+     * и лимит SSD для нее не годятся
+     * @arg first, last Файлы группы (file_entry). Номер устройства берется из
+     * file_entry::dev, stat вызывается только для файлов без него
+    */
+    template<typename It>
+    const io_device& of_files(It first, It last){
+        const io_device* found = nullptr;
+        /* Файлы группы обычно лежат подряд на одном устройстве - таблица не запрашивается повторно */
+        const io_device* previous = nullptr;
+        for (; first != last; ++first){
+            const io_device* device;
+            if (first->dev == 0)                                    device = &of_file(first->path);
+            else if (previous && previous->dev == first->dev)       device = previous;
+            else                                                    device = &of(first->dev);
+            previous = device;
+
+            if (found == nullptr || (device->rotational && !found->rotational)) found = device;
+            if (found->rotational) break;
+        }
+        return found ? *found : of(0);
+    }
+};
+
+/**
+ * @brief Физическое смещение начала файла на устройстве (первый экстент FIEMAP)
+ * @return 0, если ФС не сообщает расположение или у файла нет экстентов
+*/
+inline std::uint64_t physical_offset(const boost::filesystem::path& file){
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    /* Запрос с местом под один экстент */
+    alignas(struct fiemap) char request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    auto map = reinterpret_cast<struct fiemap*>(request);
+    map->fm_start        = 0;
+    map->fm_length       = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+
+    std::uint64_t offset = 0;
+    if (::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0){
+        offset = map->fm_extents[0].fe_physical;
+    }
+    ::close(fd);
+    return offset;
+}
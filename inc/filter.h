@@ -0,0 +1,284 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Автомат Ахо-Корасик для поиска любой из подстрок без учета регистра (ASCII).
+ * Переходы построены для всех состояний заранее, поэтому имя проходится
+ * один раз, по одному переходу на байт
+*/
+class substring_matcher {
+private:
+    /* Класс байта: байты, не встречающиеся в подстроках, - класс 0 */
+    std::array<std::uint8_t, 256> _class{};
+    std::size_t _classes = 1;
+    /* Таблица переходов: состояние * _classes + класс */
+    std::vector<std::uint32_t> _next;
+    /* В состоянии заканчивается одна из подстрок */
+    std::vector<char> _accept;
+
+public:
+    substring_matcher() = default;
+
+    /**
+     * @arg patterns Подстроки в нижнем регистре
+    */
+    explicit substring_matcher(const std::vector<std::string>& patterns){
+        if (patterns.empty()) return;
+
+        for (const auto& p : patterns){
+            for (unsigned char c : p){
+                if (_class[c] != 0) continue;
+                if (_classes == 256){
+                    std::cerr << "Слишком много различных символов в масках" << std::endl;
+                    throw std::exception();
+                }
+                _class[c] = static_cast<std::uint8_t>(_classes);
+                _class[std::toupper(c)] = static_cast<std::uint8_t>(_classes);
+                _classes++;
+            }
+        }
+
+        /* Бор подстрок; отсутствующий переход - 0 */
+        constexpr std::uint32_t none = 0;
+        _next.assign(_classes, none);
+        _accept.assign(1, 0);
+        for (const auto& p : patterns){
+            std::uint32_t state = 0;
+            for (unsigned char c : p){
+                std::size_t at = state * _classes + _class[c];
+                if (_next[at] == none){
+                    _next[at] = static_cast<std::uint32_t>(_accept.size());
+                    _accept.push_back(0);
+                    _next.resize(_next.size() + _classes, none);
+                }
+                state = _next[at];
+            }
+            _accept[state] = 1;
+        }
+
+        /* Обход в ширину: переходы по суффиксным ссылкам достраиваются до полного автомата */
+        std::vector<std::uint32_t> fail(_accept.size(), 0);
+        std::queue<std::uint32_t> queue;
+        for (std::size_t c = 0; c < _classes; c++){
+            if (_next[c] != none) queue.push(_next[c]);
+        }
+
+        while (!queue.empty()){
+            std::uint32_t state = queue.front();
+            queue.pop();
+            _accept[state] |= _accept[fail[state]];
+
+            for (std::size_t c = 0; c < _classes; c++){
+                std::uint32_t& to = _next[state * _classes + c];
+                std::uint32_t via = _next[fail[state] * _classes + c];
+                if (to == none){
+                    to = via;
+                } else {
+                    fail[to] = via;
+                    queue.push(to);
+                }
+            }
+        }
+    }
+
+    bool empty() const {
+        return _accept.empty();
+    }
+
+    /**
+     * @brief Содержит ли строка хотя бы одну из подстрок
+    */
+    bool any(const char* s) const {
+        if (_accept.empty()) return false;
+        if (_accept[0]) return true;
+
+        std::uint32_t state = 0;
+        for (; *s; s++){
+            state = _next[state * _classes + _class[static_cast<unsigned char>(*s)]];
+            if (_accept[state]) return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Фильтры сканирования, собранные из масок и исключений конфига один раз.
+ * Маска без символов *?[ - подстрока имени, с ними - шаблон всего имени (fnmatch).
+ * Исключение без '/' - имя (или шаблон имени) директории. Исключение с '/' без
+ * символов шаблона - путь, под которым исключено все дерево, с ними - шаблон пути
+*/
+class scan_filter {
+private:
+    substring_matcher _substrings;
+    std::vector<std::string> _name_globs;
+    bool _masks = false;
+
+    std::unordered_set<std::string> _exclude_paths;
+    std::vector<std::string> _exclude_names;
+    std::vector<std::string> _exclude_globs;
+
+    static bool _is_glob(const std::string& s){
+        return s.find_first_of("*?[") != std::string::npos;
+    }
+
+    /**
+     * @brief Лежит ли нормализованный путь внутри другого.
+     * Сравнение лексическое: путь с компонентом ".." после общей части,
+     * как "../x" относительно ".", считается лежащим снаружи
+    */
+    static bool _nested(const std::string& key, const std::string& parent){
+        if (key == parent) return false;
+
+        std::string_view rest(key);
+        if (parent == "."){
+            if (key[0] == '/') return false;
+        } else if (parent == "/"){
+            if (key[0] != '/') return false;
+            rest.remove_prefix(1);
+        } else {
+            if (key.size() <= parent.size() || key.compare(0, parent.size(), parent) != 0 || key[parent.size()] != '/') return false;
+            rest.remove_prefix(parent.size() + 1);
+        }
+
+        for (std::size_t start = 0; start <= rest.size(); ){
+            std::size_t end = std::min(rest.find('/', start), rest.size());
+            if (rest.substr(start, end - start) == "..") return false;
+            start = end + 1;
+        }
+        return true;
+    }
+
+public:
+    scan_filter() = default;
+
+    /**
+     * @brief Лексическая нормализация пути для сравнения с исключениями:
+     * без повторных и завершающих '/', без компонентов "." и без "..",
+     * сокращаемых с предыдущим именем ("a/../b" - "b", "/.." - "/")
+    */
+    static std::string normalize(const std::string& path){
+        std::string out;
+        out.reserve(path.size());
+        std::size_t start = 0;
+        while (start <= path.size()){
+            std::size_t end = path.find('/', start);
+            if (end == std::string::npos) end = path.size();
+            std::string_view part(path.data() + start, end - start);
+
+            if (start == 0 && part.empty()){
+                out += '/';
+            } else if (part == ".."){
+                std::size_t last = out.rfind('/');
+                std::string_view prev = (last == std::string::npos) ? std::string_view(out) : std::string_view(out).substr(last + 1);
+                if (out == "/"){
+                    /* Выше корня подниматься некуда */
+                } else if (!out.empty() && prev != ".."){
+                    out.resize(last == std::string::npos ? 0 : (last == 0 ? 1 : last));
+                } else {
+                    if (!out.empty() && out.back() != '/') out += '/';
+                    out += "..";
+                }
+            } else if (!part.empty() && part != "."){
+                if (!out.empty() && out.back() != '/') out += '/';
+                out.append(part);
+            }
+            start = end + 1;
+        }
+        return out.empty() ? std::string(".") : out;
+    }
+
+    static scan_filter from_config(){
+        const auto& conf = config::Config::instance();
+        scan_filter f;
+
+        std::vector<std::string> substrings;
+        for (const auto& mask : conf.masks){
+            if (_is_glob(mask)) f._name_globs.push_back(mask);
+            else substrings.push_back(mask);
+        }
+        f._substrings = substring_matcher(substrings);
+        f._masks = !conf.masks.empty();
+
+        for (const auto& exclude : conf.excludes){
+            const std::string& e = exclude.string();
+            if (e.find('/') == std::string::npos) f._exclude_names.push_back(e);
+            else if (!_is_glob(e))                f._exclude_paths.insert(normalize(e));
+            else                                  f._exclude_globs.push_back(normalize(e));
+        }
+        return f;
+    }
+
+    /**
+     * @brief Проходит ли имя файла по маскам
+    */
+    bool name(const char* name) const {
+        if (!_masks) return true;
+        if (_substrings.any(name)) return true;
+        for (const auto& glob : _name_globs){
+            if (::fnmatch(glob.c_str(), name, FNM_CASEFOLD) == 0) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Исключена ли сама директория. Потомков исключенной директории
+     * сканер не посещает, поэтому предки не проверяются
+    */
+    bool excluded(const boost::filesystem::path& dir) const {
+        if (_exclude_paths.empty() && _exclude_names.empty() && _exclude_globs.empty()) return false;
+
+        std::string path = normalize(dir.string());
+        if (_exclude_paths.count(path)) return true;
+
+        if (!_exclude_names.empty()){
+            const char* base = path.c_str() + (path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1);
+            for (const auto& glob : _exclude_names){
+                if (::fnmatch(glob.c_str(), base, 0) == 0) return true;
+            }
+        }
+        for (const auto& glob : _exclude_globs){
+            if (::fnmatch(glob.c_str(), path.c_str(), FNM_PATHNAME) == 0) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Исключена ли директория или один из ее предков.
+     * Нужно для директорий сканирования, которые лежат внутри исключенных
+    */
+    bool excluded_tree(const boost::filesystem::path& dir) const {
+        for (boost::filesystem::path p = dir; !p.empty(); p = p.parent_path()){
+            if (excluded(p)) return true;
+            if (p == p.parent_path()) break;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Директории сканирования без исключенных и, при рекурсивном обходе,
+     * без вложенных в другие директории сканирования - иначе их файлы
+     * были бы найдены дважды
+     * @arg includes Директории сканирования из конфига
+     * @arg recursive Обход рекурсивный
+    */
+    std::vector<boost::filesystem::path> roots(const std::set<boost::filesystem::path>& includes, bool recursive) const {
+        /* Нормализованный путь для сравнения и путь в том виде, в каком он задан */
+        std::vector<std::pair<std::string, boost::filesystem::path>> roots;
+        for (const auto& path : includes){
+            if (!excluded_tree(path)) roots.emplace_back(normalize(path.string()), path);
+        }
+        std::sort(roots.begin(), roots.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+        roots.erase(std::unique(roots.begin(), roots.end(), [](const auto& a, const auto& b){ return a.first == b.first; }), roots.end());
+
+        /* Предок не обязательно идет раньше при сортировке ("-x" < "."), поэтому проверяются все пары */
+        std::vector<boost::filesystem::path> out;
+        for (const auto& [key, path] : roots){
+            bool nested = recursive && std::any_of(roots.begin(), roots.end(), [&, &key = key](const auto& parent){
+                return _nested(key, parent.first);
+            });
+            if (!nested) out.push_back(path);
+        }
+        return out;
+    }
+};
@@ -2,6 +2,83 @@
 
 #include "babayan.hpp"
 
+/**
+ * @brief Хэш фиксированной ширины - 128 бит.
+ * Более короткие хэши дополняются нулями в старших битах
+*/
+struct digest_t {
+    std::uint64_t hi = 0;
+    std::uint64_t lo = 0;
+
+    auto operator<=>(const digest_t&) const = default;
+
+    /**
+     * @brief Собирает хэш из первых 16 байт массива (big-endian)
+    */
+    static digest_t from_bytes(const unsigned char* bytes){
+        digest_t d;
+        for (int i = 0; i < 8; i++){
+            d.hi = (d.hi << 8) | bytes[i];
+            d.lo = (d.lo << 8) | bytes[i + 8];
+        }
+        return d;
+    }
+};
+
+template<>
+struct std::hash<digest_t> {
+    std::size_t operator()(const digest_t& d) const noexcept {
+        return static_cast<std::size_t>(d.lo ^ (d.hi * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/* Размер общего блока нулей, которым хэшируются дыры разреженных файлов */
+constexpr std::size_t zero_block_size = 1 << 20;
+
+/**
+ * @brief Блок нулей размером zero_block_size
+*/
+inline const char* zero_block(){
+    static const char zeros[zero_block_size] = {};
+    return zeros;
+}
+
+/**
+ * @brief Дописывает к регистру отраженного CRC32 n нулевых байт за O(log n).
+ * Нулевой байт - линейное преобразование регистра, поэтому n байт - его степень,
+ * которая считается возведением матрицы над GF(2) в квадрат
+ * @arg crc Регистр без конечной инверсии, младший бит - старший коэффициент
+ * @arg poly Отраженный полином
+*/
+inline std::uint32_t crc32_zeros(std::uint32_t crc, std::uint64_t n, std::uint32_t poly){
+    using matrix = std::array<std::uint32_t, 32>;
+    auto times = [](const matrix& m, std::uint32_t v){
+        std::uint32_t sum = 0;
+        for (int i = 0; v != 0; i++, v >>= 1){
+            if (v & 1) sum ^= m[i];
+        }
+        return sum;
+    };
+    auto square = [&](matrix& m){
+        matrix sq;
+        for (int i = 0; i < 32; i++) sq[i] = times(m, m[i]);
+        m = sq;
+    };
+
+    /* Один нулевой бит, затем возведением в квадрат - один нулевой байт */
+    matrix op;
+    op[0] = poly;
+    for (int i = 1; i < 32; i++) op[i] = 1u << (i - 1);
+    for (int i = 0; i < 3; i++) square(op);
+
+    while (n != 0){
+        if (n & 1) crc = times(op, crc);
+        n >>= 1;
+        if (n != 0) square(op);
+    }
+    return crc;
+}
+
 /**
  * @brief Интерфейс алгоритмов хэширования
 */
@@ -14,12 +91,24 @@ public:
      * @arg size Размер блока
      * @return Хэш после расчета блока
     */
-    virtual unsigned next_hash(void* addr, const std::size_t& size) = 0;
+    virtual digest_t next_hash(const void* addr, const std::size_t& size) = 0;
+    /**
+     * @brief Комбинирует хэш с n нулевыми байтами - дырой разреженного файла.
+     * Результат тот же, что у next_hash от блока нулей
+     * @arg n Кол-во нулевых байт
+    */
+    virtual void next_zeros(std::uint64_t n){
+        while (n != 0){
+            std::size_t len = std::min<std::uint64_t>(n, zero_block_size);
+            next_hash(zero_block(), len);
+            n -= len;
+        }
+    }
     /**
      * @brief Возвращает текущий хэш
      * @return Текущий хэш
     */
-    virtual unsigned checksum() = 0;
+    virtual digest_t checksum() = 0;
     /**
      * @brief Сбрасывает текущий хэш в начальное состояние
     */
@@ -29,7 +118,9 @@ public:
 /**
  * @brief Класс расчета хэша по алгоритму CRC32
 */
-class crc32_hasher : public ihasher {
+class crc32_hasher final : public ihasher {
+public:
+    static constexpr const char* name = "crc32";
 private:
     boost::crc_32_type hash;
 public:
@@ -38,13 +129,26 @@ public:
     }
     ~crc32_hasher() = default;
 
-    unsigned next_hash(void* addr, const std::size_t& size) override {
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
         hash.process_bytes(addr, size);
-        return hash.checksum();
+        return checksum();
     };
 
-    unsigned checksum() override {
-        return hash.checksum();
+    /**
+     * @brief Нули дописываются к регистру за O(log n). Boost хранит
+     * регистр неотраженным, поэтому он отражается туда и обратно
+    */
+    void next_zeros(std::uint64_t n) override {
+        auto reflect = [](std::uint32_t v){
+            std::uint32_t r = 0;
+            for (int i = 0; i < 32; i++, v >>= 1) r = (r << 1) | (v & 1);
+            return r;
+        };
+        hash.reset(reflect(crc32_zeros(reflect(hash.get_interim_remainder()), n, 0xedb88320u)));
+    }
+
+    digest_t checksum() override {
+        return digest_t{0, hash.checksum()};
     }
 
     void reset() override {
@@ -55,26 +159,363 @@ public:
 /**
  * @brief Класс расчета хэша по алгоритму MD5
 */
-class md5_hasher : public ihasher {
+class md5_hasher final : public ihasher {
+public:
+    static constexpr const char* name = "md5";
 private:
     boost::uuids::detail::md5 hash;
-    boost::uuids::detail::md5::digest_type result;
+    digest_t result;
 public:
     md5_hasher() {
+        reset();
     }
     ~md5_hasher() = default;
 
-    unsigned next_hash(void* addr, const std::size_t& size) override {
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
         hash.process_bytes(addr, size);
-        hash.get_digest(result);
-        return *result;
+
+        /* get_digest завершает контекст, поэтому итог считается на копии */
+        boost::uuids::detail::md5 tmp = hash;
+        boost::uuids::detail::md5::digest_type words;
+        tmp.get_digest(words);
+
+        /* Слова хэша хранятся как числа, старший байт - первый байт хэша */
+        unsigned char bytes[16];
+        for (int i = 0; i < 4; i++){
+            bytes[i * 4 + 0] = static_cast<unsigned char>(words[i] >> 24);
+            bytes[i * 4 + 1] = static_cast<unsigned char>(words[i] >> 16);
+            bytes[i * 4 + 2] = static_cast<unsigned char>(words[i] >> 8);
+            bytes[i * 4 + 3] = static_cast<unsigned char>(words[i]);
+        }
+        result = digest_t::from_bytes(bytes);
+        return result;
     };
 
-    unsigned checksum() override {
-        return *result;
+    digest_t checksum() override {
+        return result;
     }
 
     void reset() override {
+        hash   = boost::uuids::detail::md5();
+        result = digest_t{};
     }
 };
 
+
+namespace crc32c_detail {
+
+/* Функция расчета CRC32C над блоком без начальной и конечной инверсии */
+using kernel_t = std::uint32_t (*)(std::uint32_t crc, const unsigned char* p, std::size_t n);
+
+/**
+ * @brief Таблицы для программного расчета CRC32C (slicing-by-8)
+*/
+struct tables {
+    std::uint32_t t[8][256];
+
+    tables() {
+        for (std::uint32_t i = 0; i < 256; i++){
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; k++){
+                c = (c & 1) ? (c >> 1) ^ 0x82f63b78u : (c >> 1);
+            }
+            t[0][i] = c;
+        }
+        for (std::uint32_t i = 0; i < 256; i++){
+            for (int k = 1; k < 8; k++){
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+
+    static const tables& instance(){
+        static tables tbl;
+        return tbl;
+    }
+};
+
+inline std::uint32_t software(std::uint32_t crc, const unsigned char* p, std::size_t n){
+    const auto& t = tables::instance().t;
+
+    while (n >= 8){
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        v ^= crc;
+        crc = t[7][v & 0xff]         ^ t[6][(v >> 8) & 0xff]  ^
+              t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+              t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+              t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+        p += 8;
+        n -= 8;
+    }
+    while (n--){
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline std::uint32_t sse42(std::uint32_t crc, const unsigned char* p, std::size_t n){
+    std::uint64_t c = crc;
+    while (n >= 8){
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<std::uint32_t>(c);
+    while (n--){
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+#if defined(__aarch64__)
+__attribute__((target("+crc")))
+inline std::uint32_t armv8(std::uint32_t crc, const unsigned char* p, std::size_t n){
+    while (n >= 8){
+        std::uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n--){
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * @brief Выбирает самую быструю реализацию, доступную на этом процессоре
+*/
+inline kernel_t select(){
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) return sse42;
+#endif
+#if defined(__aarch64__)
+    if (::getauxval(AT_HWCAP) & HWCAP_CRC32) return armv8;
+#endif
+    return software;
+}
+
+inline kernel_t kernel(){
+    static const kernel_t k = select();
+    return k;
+}
+
+} // namespace crc32c_detail
+
+/**
+ * @brief Класс расчета хэша по алгоритму CRC32C (Castagnoli).
+ * Использует инструкции SSE4.2 или ARMv8 CRC, если процессор их поддерживает
+*/
+class crc32c_hasher final : public ihasher {
+public:
+    static constexpr const char* name = "crc32c";
+private:
+    crc32c_detail::kernel_t kernel;
+    std::uint32_t state;
+public:
+    crc32c_hasher() : kernel(crc32c_detail::kernel()) {
+        reset();
+    }
+    ~crc32c_hasher() = default;
+
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
+        state = kernel(state, static_cast<const unsigned char*>(addr), size);
+        return checksum();
+    };
+
+    /**
+     * @brief Нули дописываются к регистру за O(log n)
+    */
+    void next_zeros(std::uint64_t n) override {
+        state = crc32_zeros(state, n, 0x82f63b78u);
+    }
+
+    digest_t checksum() override {
+        return digest_t{0, ~state};
+    }
+
+    void reset() override {
+        state = 0xffffffffu;
+    }
+};
+
+#ifdef BABAYAN_WITH_XXHASH
+/* С xxh_x86dispatch реализация выбирается по возможностям процессора при запуске */
+#ifdef BABAYAN_XXHASH_DISPATCH
+#define BABAYAN_XXH3(fn) fn##_dispatch
+#else
+#define BABAYAN_XXH3(fn) fn
+#endif
+
+/**
+ * @brief Класс расчета хэша по алгоритму XXH3 (64 бита)
+*/
+class xxh3_hasher final : public ihasher {
+public:
+    static constexpr const char* name = "xxh3";
+private:
+    XXH3_state_t* state;
+public:
+    xxh3_hasher() : state(XXH3_createState()) {
+        if (state == nullptr) throw std::bad_alloc();
+        reset();
+    }
+    ~xxh3_hasher() {
+        XXH3_freeState(state);
+    }
+    xxh3_hasher(const xxh3_hasher&) = delete;
+
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
+        BABAYAN_XXH3(XXH3_64bits_update)(state, addr, size);
+        return checksum();
+    };
+
+    digest_t checksum() override {
+        return digest_t{0, XXH3_64bits_digest(state)};
+    }
+
+    void reset() override {
+        XXH3_64bits_reset(state);
+    }
+};
+
+/**
+ * @brief Класс расчета хэша по алгоритму XXH3 (128 бит)
+*/
+class xxh128_hasher final : public ihasher {
+public:
+    static constexpr const char* name = "xxh128";
+private:
+    XXH3_state_t* state;
+public:
+    xxh128_hasher() : state(XXH3_createState()) {
+        if (state == nullptr) throw std::bad_alloc();
+        reset();
+    }
+    ~xxh128_hasher() {
+        XXH3_freeState(state);
+    }
+    xxh128_hasher(const xxh128_hasher&) = delete;
+
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
+        BABAYAN_XXH3(XXH3_128bits_update)(state, addr, size);
+        return checksum();
+    };
+
+    digest_t checksum() override {
+        XXH128_hash_t h = XXH3_128bits_digest(state);
+        return digest_t{h.high64, h.low64};
+    }
+
+    void reset() override {
+        XXH3_128bits_reset(state);
+    }
+};
+#endif
+
+#ifdef BABAYAN_WITH_BLAKE3
+/**
+ * @brief Класс расчета хэша по алгоритму BLAKE3.
+ * Библиотека сама выбирает SIMD-реализацию (AVX-512, AVX2, SSE4.1, NEON)
+ * и хэширует блоки по 1 КиБ дерева параллельно в нескольких дорожках.
+ * Хэш усекается до 128 бит
+*/
+class blake3_hasher_t final : public ihasher {
+public:
+    static constexpr const char* name = "blake3";
+private:
+    blake3_hasher hash;
+public:
+    blake3_hasher_t() {
+        reset();
+    }
+    ~blake3_hasher_t() = default;
+
+    digest_t next_hash(const void* addr, const std::size_t& size) override {
+        blake3_hasher_update(&hash, addr, size);
+        return checksum();
+    };
+
+    digest_t checksum() override {
+        unsigned char out[16];
+        blake3_hasher_finalize(&hash, out, sizeof(out));
+        return digest_t::from_bytes(out);
+    }
+
+    void reset() override {
+        blake3_hasher_init(&hash);
+    }
+};
+#endif
+
+/**
+ * @brief Список алгоритмов хэширования, из которых выбирается Reader.
+ * Новый алгоритм - класс с полем name и строка в этом списке
+*/
+template<typename... H>
+struct hasher_list {};
+
+using hashers = hasher_list<
+    crc32_hasher, md5_hasher, crc32c_hasher
+#ifdef BABAYAN_WITH_XXHASH
+    , xxh3_hasher, xxh128_hasher
+#endif
+#ifdef BABAYAN_WITH_BLAKE3
+    , blake3_hasher_t
+#endif
+>;
+
+/**
+ * @brief Алгоритм по умолчанию. 128-битный: группы, найденные по хэшам,
+ * выводятся без побайтной проверки, а 32-битные CRC легко подобрать
+*/
+#ifdef BABAYAN_WITH_XXHASH
+inline constexpr const char* default_hasher = xxh128_hasher::name;
+#else
+inline constexpr const char* default_hasher = md5_hasher::name;
+#endif
+
+template<typename F, typename... H>
+bool _with_hasher(const std::string& name, F& f, hasher_list<H...>){
+    return ((name == H::name ? (f.template operator()<H>(), true) : false) || ...);
+}
+
+/**
+ * @brief Вызывает f.template operator()<H>() для алгоритма с этим именем
+ * @return false, если алгоритм неизвестен
+*/
+template<typename F>
+bool with_hasher(const std::string& name, F&& f){
+    return _with_hasher(name, f, hashers{});
+}
+
+template<typename... H>
+std::vector<std::string> _hasher_names(hasher_list<H...>){
+    return {H::name...};
+}
+
+/**
+ * @brief Имена всех доступных алгоритмов хэширования
+*/
+inline const std::vector<std::string>& hasher_names(){
+    static const std::vector<std::string> names = _hasher_names(hashers{});
+    return names;
+}
+
+/**
+ * @brief Создает хэшер по имени алгоритма
+ * @return nullptr, если алгоритм неизвестен
+*/
+inline std::unique_ptr<ihasher> make_hasher(const std::string& name){
+    std::unique_ptr<ihasher> hasher;
+    with_hasher(name, [&]<typename H>(){ hasher = std::make_unique<H>(); });
+    return hasher;
+}
@@ -12,10 +12,13 @@ struct file_entry {
     /* Путь к файлу */
     boost::filesystem::path path;
     /* Размер файла */
-    unsigned size;
+    std::uint64_t size;
+    /* Устройство и inode файла. ino == 0 - неизвестны */
+    std::uint64_t dev = 0;
+    std::uint64_t ino = 0;
 
-    file_entry(boost::filesystem::path path_, unsigned size_) :
-        path(path_), size(size_)
+    file_entry(boost::filesystem::path path_, std::uint64_t size_, std::uint64_t dev_ = 0, std::uint64_t ino_ = 0) :
+        path(path_), size(size_), dev(dev_), ino(ino_)
     {}
 };
 
@@ -29,21 +32,39 @@ typedef multi_index_container<
     file_entry,
     indexed_by<
         hashed_unique<tag<path>,  BOOST_MULTI_INDEX_MEMBER(file_entry, boost::filesystem::path, path)>,
-        ordered_non_unique<tag<size>,  BOOST_MULTI_INDEX_MEMBER(file_entry, unsigned, size)>
+        ordered_non_unique<tag<size>,  BOOST_MULTI_INDEX_MEMBER(file_entry, std::uint64_t, size)>
     >
 > file_set;
 
-using iter_t = boost::multi_index::detail::bidir_node_iterator<
-        boost::multi_index::detail::ordered_index_node<
-            boost::multi_index::detail::null_augment_policy, 
-                boost::multi_index::detail::index_node_base<
-                    file_entry, 
-                    std::allocator<file_entry> 
-                > 
-            > 
-        >;
-using coro_pull_t = boost::coroutines2::coroutine<std::pair<iter_t, iter_t>>::pull_type;
-using coro_push_t = boost::coroutines2::coroutine<std::pair<iter_t, iter_t>>::push_type;
+/**
+ * @brief Группа файлов одинакового размера.
+ * Файлы группы лежат подряд в общем векторе, которым группа владеет совместно
+ * с обработчиками, поэтому ее можно передавать в другие потоки
+*/
+struct file_group {
+    using iterator = std::vector<file_entry>::const_iterator;
+
+    /* Размер файлов группы */
+    std::uint64_t size = 0;
+    /* Кол-во файлов группы, даже если сами файлы не выданы */
+    std::size_t count = 0;
+    std::shared_ptr<const std::vector<file_entry>> files;
+    /* Первый файл группы и следующий за последним */
+    iterator first, second;
+
+    file_group() = default;
+
+    file_group(std::uint64_t size_, std::size_t count_, std::shared_ptr<const std::vector<file_entry>> files_) :
+        size(size_), count(count_), files(std::move(files_))
+    {
+        if (!files) files = std::make_shared<const std::vector<file_entry>>();
+        first  = files->begin();
+        second = files->end();
+    }
+};
+
+using coro_pull_t = boost::coroutines2::coroutine<file_group>::pull_type;
+using coro_push_t = boost::coroutines2::coroutine<file_group>::push_type;
 
 /**
  * @brief Интерфейс хранилища файлов отобранных для сканирования
@@ -51,38 +72,343 @@ using coro_push_t = boost::coroutines2::coroutine<std::pair<iter_t, iter_t>>::pu
 class IKeeper {
 public:
     virtual ~IKeeper() = default;
-    virtual void add_file(boost::filesystem::path file, unsigned size) = 0;
+    /**
+     * @brief Добавляет файл в хранилище. Может вызываться из нескольких потоков
+    */
+    virtual void add_file(boost::filesystem::path file, std::uint64_t size) = 0;
+    /**
+     * @brief Добавляет пачку файлов в хранилище. Может вызываться из нескольких потоков
+    */
+    virtual void add_files(const std::vector<file_entry>& files) {
+        for (const auto& f : files){
+            add_file(f.path, f.size);
+        }
+    }
     /**
      * @brief Группирует список файлов по размеру
-     * @return Генератор-корутина, которая возвращает пары итераторов
-     * на первый файл из группы с одинаковым размером файлов и 
-     * последний файл из этой группы
+     * @arg min_files Группы меньше этого размера выдаются без файлов (только size и count)
+     * @return Генератор-корутина, которая возвращает группы файлов
+     * одинакового размера в порядке возрастания размера
     */
-    virtual coro_pull_t group_by_size() = 0;
+    virtual coro_pull_t group_by_size(std::size_t min_files = 1) = 0;
 };
 
 class Keeper : public IKeeper {
 private:
     /* Отобранные файлы */
     file_set _files;
+    /* Защищает _files при параллельном сканировании */
+    std::mutex _mutex;
 public:
     Keeper() {}
-    void add_file(boost::filesystem::path file, unsigned size) override {
+    void add_file(boost::filesystem::path file, std::uint64_t size) override {
+        std::lock_guard<std::mutex> lock(_mutex);
         _files.insert(file_entry(file, size));
     }
+
+    void add_files(const std::vector<file_entry>& files) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _files.insert(files.begin(), files.end());
+    }
     
-    coro_pull_t group_by_size() override {
-        coro_pull_t coro([&](coro_push_t& yield){
+    coro_pull_t group_by_size(std::size_t min_files = 1) override {
+        coro_pull_t coro([&, min_files](coro_push_t& yield){
             const typename boost::multi_index::index<file_set, size>::type& filesBySize= get<size>(_files);
             auto start = filesBySize.begin();
             auto end   = filesBySize.end();
 
             while(start != end){
                 auto iters = filesBySize.equal_range(start->size);
-                yield(iters);
+                std::size_t count = boost::distance(iters.first, iters.second);
+
+                std::shared_ptr<std::vector<file_entry>> files;
+                if (count >= min_files){
+                    files = std::make_shared<std::vector<file_entry>>(iters.first, iters.second);
+                }
+                yield(file_group(start->size, count, std::move(files)));
                 start = iters.second;
             }
         });
         return coro;
     }
 };
+
+/**
+ * @brief Компактное хранилище файлов.
+ * Пути не хранятся целиком: директории интернированы деревом узлов
+ * (родитель + имя компонента), так что общие префиксы хранятся один раз,
+ * а имена файлов и компонентов лежат в общей арене. Запись файла - 32 байта,
+ * устройство файла хранится в узле его директории.
+ * Группировка - поразрядная сортировка записей по 64-битному размеру,
+ * группы получаются непрерывными диапазонами. Повторы одного пути
+ * отбрасываются при выдаче группы
+*/
+class FlatKeeper : public IKeeper {
+private:
+    /* Размер куска арены имен */
+    static constexpr std::size_t _chunk_size = 64 << 10;
+    /* Нет директории: путь без '/' */
+    static constexpr std::uint32_t _no_dir = std::numeric_limits<std::uint32_t>::max();
+
+    /* Устройство директории еще не известно */
+    static constexpr std::uint64_t _no_dev = std::numeric_limits<std::uint64_t>::max();
+
+    struct flat_file {
+        std::uint64_t size;
+        const char*   name;
+        std::uint32_t dir;
+        std::uint32_t len;
+        /* inode файла; 0 - неизвестен или файл лежит на другом устройстве, чем директория */
+        std::uint64_t ino;
+    };
+
+    /* Узел дерева директорий: компонент пути, родитель и устройство файлов директории */
+    struct dir_node {
+        const char*   name;
+        std::uint32_t len;
+        std::uint32_t parent;
+        std::uint64_t dev;
+    };
+
+    struct node_key {
+        std::uint32_t parent;
+        std::string_view name;
+
+        bool operator==(const node_key&) const = default;
+    };
+
+    struct node_hash {
+        std::size_t operator()(const node_key& k) const {
+            return std::hash<std::string_view>()(k.name) ^ (k.parent * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    std::vector<flat_file> _files;
+    std::vector<dir_node> _dirs;
+    std::unordered_map<node_key, std::uint32_t, node_hash> _index;
+
+    /* Арена имен: куски не перемещаются, поэтому указатели на имена стабильны */
+    std::vector<std::unique_ptr<char[]>> _chunks;
+    char* _chunk = nullptr;
+    std::size_t _chunk_used = _chunk_size;
+
+    /* Последняя интернированная директория: файлы приходят пачками из одной директории */
+    std::string _last_dir;
+    std::uint32_t _last_id = _no_dir;
+    bool _has_last = false;
+
+    /* _files упорядочен по размеру */
+    bool _sorted = true;
+    std::mutex _mutex;
+
+    const char* _store(std::string_view s){
+        if (s.size() > _chunk_size / 4){
+            _chunks.emplace_back(new char[s.size()]);
+            std::memcpy(_chunks.back().get(), s.data(), s.size());
+            return _chunks.back().get();
+        }
+        if (_chunk_used + s.size() > _chunk_size){
+            _chunks.emplace_back(new char[_chunk_size]);
+            _chunk = _chunks.back().get();
+            _chunk_used = 0;
+        }
+        char* dst = _chunk + _chunk_used;
+        std::memcpy(dst, s.data(), s.size());
+        _chunk_used += s.size();
+        return dst;
+    }
+
+    std::uint32_t _intern(std::uint32_t parent, std::string_view name){
+        auto it = _index.find(node_key{parent, name});
+        if (it != _index.end()) return it->second;
+
+        const char* stored = _store(name);
+        std::uint32_t id = static_cast<std::uint32_t>(_dirs.size());
+        _dirs.push_back(dir_node{stored, static_cast<std::uint32_t>(name.size()), parent, _no_dev});
+        _index.emplace(node_key{parent, std::string_view(stored, name.size())}, id);
+        return id;
+    }
+
+    /**
+     * @brief Узел директории. Компоненты разделяются по '/', пустые компоненты
+     * сохраняются, чтобы путь восстанавливался байт в байт
+    */
+    std::uint32_t _dir_id(std::string_view dir){
+        if (_has_last && dir == _last_dir) return _last_id;
+
+        std::uint32_t id = _no_dir;
+        std::size_t start = 0;
+        while (true){
+            std::size_t end = dir.find('/', start);
+            id = _intern(id, dir.substr(start, end == std::string_view::npos ? end : end - start));
+            if (end == std::string_view::npos) break;
+            start = end + 1;
+        }
+
+        _last_dir.assign(dir);
+        _last_id  = id;
+        _has_last = true;
+        return id;
+    }
+
+    void _add(const std::string& path, std::uint64_t size, std::uint64_t dev = 0, std::uint64_t ino = 0){
+        std::string_view p(path);
+        std::size_t slash = p.rfind('/');
+
+        flat_file f;
+        f.size = size;
+        f.ino  = 0;
+        if (slash == std::string_view::npos){
+            f.dir = _no_dir;
+        } else {
+            f.dir = _dir_id(p.substr(0, slash));
+            p.remove_prefix(slash + 1);
+
+            /* Файл, примонтированный с другого устройства, остается без inode */
+            dir_node& d = _dirs[f.dir];
+            if (d.dev == _no_dev) d.dev = dev;
+            if (d.dev == dev) f.ino = ino;
+        }
+        f.name = _store(p);
+        f.len  = static_cast<std::uint32_t>(p.size());
+        _files.push_back(f);
+        _sorted = false;
+    }
+
+    void _append_dir(std::string& out, std::uint32_t id) const {
+        if (id == _no_dir) return;
+        const dir_node& d = _dirs[id];
+        if (d.parent != _no_dir){
+            _append_dir(out, d.parent);
+            out += '/';
+        }
+        out.append(d.name, d.len);
+    }
+
+    /**
+     * @brief Поразрядная (LSD) сортировка записей по размеру, 16 бит за проход.
+     * Проходы, в которых у всех размеров одинаковая цифра, пропускаются.
+     * Сортировка устойчива: внутри группы сохраняется порядок добавления
+    */
+    void _sort(){
+        if (_sorted) return;
+
+        std::vector<flat_file> tmp(_files.size());
+        std::vector<std::size_t> count(1 << 16);
+
+        for (unsigned shift = 0; shift < 64; shift += 16){
+            std::fill(count.begin(), count.end(), 0);
+            for (const auto& f : _files) count[(f.size >> shift) & 0xffff]++;
+            if (std::find(count.begin(), count.end(), _files.size()) != count.end()) continue;
+
+            std::size_t sum = 0;
+            for (auto& c : count){
+                std::size_t n = c;
+                c = sum;
+                sum += n;
+            }
+            for (const auto& f : _files) tmp[count[(f.size >> shift) & 0xffff]++] = f;
+            _files.swap(tmp);
+        }
+
+        _sorted = true;
+    }
+
+    /**
+     * @brief Отбрасывает повторы одного пути внутри группы, сохраняя первое вхождение
+    */
+    static void _unique(std::vector<const flat_file*>& group){
+        if (group.size() < 2) return;
+
+        auto same = [](const flat_file* a, const flat_file* b){
+            return a->dir == b->dir && a->len == b->len && std::memcmp(a->name, b->name, a->len) == 0;
+        };
+
+        /* Небольшие группы проверяются попарно без выделения памяти */
+        if (group.size() <= 16){
+            std::size_t out = 0;
+            for (std::size_t i = 0; i < group.size(); i++){
+                bool seen = false;
+                for (std::size_t j = 0; j < out && !seen; j++) seen = same(group[j], group[i]);
+                if (!seen) group[out++] = group[i];
+            }
+            group.resize(out);
+            return;
+        }
+
+        std::vector<std::size_t> order(group.size());
+        std::iota(order.begin(), order.end(), 0);
+        auto key = [&](std::size_t i){
+            return std::make_pair(group[i]->dir, std::string_view(group[i]->name, group[i]->len));
+        };
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){ return key(a) < key(b); });
+
+        std::vector<bool> drop(group.size(), false);
+        for (std::size_t i = 1; i < order.size(); i++){
+            if (key(order[i]) == key(order[i - 1])) drop[order[i]] = true;
+        }
+
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < group.size(); i++){
+            if (!drop[i]) group[out++] = group[i];
+        }
+        group.resize(out);
+    }
+
+public:
+    FlatKeeper() = default;
+
+    void add_file(boost::filesystem::path file, std::uint64_t size) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _add(file.string(), size);
+    }
+
+    void add_files(const std::vector<file_entry>& files) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _files.reserve(_files.size() + files.size());
+        for (const auto& f : files){
+            _add(f.path.string(), f.size, f.dev, f.ino);
+        }
+    }
+
+    coro_pull_t group_by_size(std::size_t min_files = 1) override {
+        coro_pull_t coro([&, min_files](coro_push_t& yield){
+            _sort();
+
+            std::vector<const flat_file*> group;
+            std::string path, dir;
+            std::uint32_t dir_id = _no_dir;
+            auto start = _files.begin();
+
+            while (start != _files.end()){
+                auto end = start;
+                while (end != _files.end() && end->size == start->size) end++;
+
+                group.clear();
+                for (auto it = start; it != end; it++) group.push_back(&*it);
+                if (group.size() > 1) _unique(group);
+
+                std::shared_ptr<std::vector<file_entry>> files;
+                if (group.size() >= min_files){
+                    files = std::make_shared<std::vector<file_entry>>();
+                    files->reserve(group.size());
+                    for (auto f : group){
+                        if (f->dir != dir_id){
+                            dir.clear();
+                            _append_dir(dir, f->dir);
+                            if (f->dir != _no_dir) dir += '/';
+                            dir_id = f->dir;
+                        }
+                        path = dir;
+                        path.append(f->name, f->len);
+                        files->emplace_back(path, f->size, f->ino ? _dirs[f->dir].dev : 0, f->ino);
+                    }
+                }
+
+                yield(file_group(start->size, group.size(), std::move(files)));
+                start = end;
+            }
+        });
+        return coro;
+    }
+};
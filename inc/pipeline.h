@@ -0,0 +1,215 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/* Оценка памяти под запись хэш-таблицы сверх строки пути, байт */
+constexpr std::size_t pipeline_entry_cost = 64;
+
+/**
+ * @brief Подписи файлов, вычисленные заранее во время сканирования.
+ * Каждая подпись забирается один раз - при сравнении группы файла
+*/
+class signature_store {
+private:
+    std::mutex _mutex;
+    std::unordered_map<std::string, digest_t> _signatures;
+    /* Хотя бы одна подпись была добавлена: без конвейера поиск не берет мьютекс */
+    std::atomic<bool> _used{false};
+    /* Лимит памяти под подписи (0 - без лимита) и ее оценка, байт */
+    std::size_t _limit = 0;
+    std::size_t _bytes = 0;
+
+    static std::size_t _cost(const std::string& path){
+        return path.size() + sizeof(digest_t) + pipeline_entry_cost;
+    }
+
+    signature_store() = default;
+public:
+    signature_store(const signature_store&) = delete;
+
+    static signature_store& instance(){
+        static signature_store store;
+        return store;
+    }
+
+    /**
+     * @brief Устанавливает лимит памяти под подписи
+     * @arg bytes Лимит в байтах, 0 - без лимита
+    */
+    void limit(std::size_t bytes){
+        std::lock_guard<std::mutex> lock(_mutex);
+        _limit = bytes;
+    }
+
+    /**
+     * @brief Сохраняет подпись файла. Сверх лимита подпись отбрасывается -
+     * Reader посчитает ее сам
+    */
+    void put(const std::string& path, const digest_t& signature){
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_limit > 0 && _bytes + _cost(path) > _limit) return;
+
+        auto [it, inserted] = _signatures.insert_or_assign(path, signature);
+        if (inserted) _bytes += _cost(path);
+        _used.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief Удаляет подписи, которые так и не понадобились
+    */
+    void clear(){
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<std::string, digest_t>().swap(_signatures);
+        _bytes = 0;
+        _used.store(false, std::memory_order_release);
+    }
+
+    /**
+     * @brief Забирает подпись файла
+     * @return false, если подпись не вычислялась
+    */
+    bool take(const std::string& path, digest_t& signature){
+        if (!_used.load(std::memory_order_acquire)) return false;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _signatures.find(path);
+        if (it == _signatures.end()) return false;
+
+        signature = it->second;
+        _bytes -= _cost(path);
+        _signatures.erase(it);
+        return true;
+    }
+};
+
+/**
+ * @brief Хранилище-обертка для конвейерного режима.
+ * Как только у размера появляется второй кандидат, подписи его файлов
+ * вычисляются на отдельном пуле, пока сканирование продолжается.
+ * Файлам, для которых подпись не нужна, заранее подгружается содержимое.
+ * Окончательная группировка - во внутреннем хранилище после сканирования.
+ * С лимитом памяти по 1/16 лимита отводится под первые файлы размеров,
+ * очередь упреждающих задач и подписи; сверх них упреждающая работа пропускается
+*/
+class PipelineKeeper : public IKeeper {
+private:
+    std::shared_ptr<IKeeper> _inner;
+    /* Лимит памяти каждой из структур конвейера, байт (0 - без лимита) */
+    const std::size_t _limit;
+
+    /* Первый файл каждого размера. Пустой путь - у размера уже больше одного кандидата */
+    std::unordered_map<std::uint64_t, std::string> _first;
+    /* Оценка памяти под _first, байт */
+    std::size_t _first_bytes = 0;
+    std::mutex _mutex;
+
+    boost::asio::thread_pool _pool;
+    /* Оценка памяти под путями в очереди пула, байт */
+    std::atomic<std::size_t> _queued_bytes{0};
+    /* Хранилище уничтожается, невыполненные упреждающие задачи отменяются */
+    std::atomic<bool> _stop{false};
+
+    void _speculate(std::string path, std::uint64_t size){
+        std::size_t cost = path.size() + pipeline_entry_cost;
+        if (_limit > 0 && _queued_bytes.load(std::memory_order_relaxed) + cost > _limit) return;
+        _queued_bytes.fetch_add(cost, std::memory_order_relaxed);
+
+        boost::asio::post(_pool, [this, path = std::move(path), size, cost](){
+            _queued_bytes.fetch_sub(cost, std::memory_order_relaxed);
+            if (_stop.load(std::memory_order_relaxed)) return;
+
+            if (signature_worthwhile(size)){
+                try {
+                    boost::filesystem::path file(path);
+                    auto source = make_source(file);
+                    signature_store::instance().put(path, sample_signature(*source, size));
+                    stats::local().speculated.add();
+                } catch(const std::exception&) {
+                    /* Reader повторит чтение и сам сообщит об ошибке */
+                }
+                return;
+            }
+
+            /* Чтение в обход кэша не выигрывает от подгрузки страниц */
+            if (cache_policy_of_config() == cache_policy::direct) return;
+
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return;
+            ::posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+            ::close(fd);
+            stats::local().prefetched.add();
+        });
+    }
+
+    /**
+     * @brief Учитывает файлы и запускает упреждающую работу для размеров,
+     * у которых больше одного кандидата
+    */
+    void _note(const std::vector<file_entry>& files){
+        std::vector<std::pair<std::string, std::uint64_t>> work;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const auto& f : files){
+                /* Сверх лимита размеры забываются: их файлы досчитает Reader */
+                if (_limit > 0 && _first_bytes > _limit){
+                    std::unordered_map<std::uint64_t, std::string>().swap(_first);
+                    _first_bytes = 0;
+                }
+
+                auto [it, inserted] = _first.try_emplace(f.size);
+                if (inserted){
+                    it->second = f.path.string();
+                    _first_bytes += it->second.size() + pipeline_entry_cost;
+                    continue;
+                }
+                if (!it->second.empty()){
+                    work.emplace_back(std::move(it->second), f.size);
+                    it->second.clear();
+                }
+                work.emplace_back(f.path.string(), f.size);
+            }
+        }
+
+        for (auto& [path, size] : work){
+            _speculate(std::move(path), size);
+        }
+    }
+
+public:
+    explicit PipelineKeeper(std::shared_ptr<IKeeper> inner) :
+        _inner(std::move(inner)),
+        _limit((config::Config::instance().memory_limit << 20) / 16),
+        _pool(std::max<std::size_t>(config::Config::instance().threads, 1))
+    {
+        signature_store::instance().limit(_limit);
+    }
+
+    ~PipelineKeeper() {
+        _stop.store(true, std::memory_order_relaxed);
+        _pool.join();
+    }
+
+    void add_file(boost::filesystem::path file, std::uint64_t size) override {
+        std::vector<file_entry> files{file_entry(std::move(file), size)};
+        add_files(files);
+    }
+
+    void add_files(const std::vector<file_entry>& files) override {
+        _inner->add_files(files);
+        _note(files);
+    }
+
+    /**
+     * @brief Дожидается упреждающей работы и группирует файлы.
+     * Оставшиеся в очереди задачи - те же выборки, которые иначе сделал бы Reader
+    */
+    coro_pull_t group_by_size(std::size_t min_files = 1) override {
+        _pool.join();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::unordered_map<std::uint64_t, std::string>().swap(_first);
+            _first_bytes = 0;
+        }
+        return _inner->group_by_size(min_files);
+    }
+};
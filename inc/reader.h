@@ -2,7 +2,7 @@
 
 #include "babayan.hpp"
 
-/* Мьютекс на доступ к std::cout */
+/* Мьютекс на доступ к std::cerr */
 boost::mutex io_mutex;
 
 /**
@@ -13,37 +13,60 @@ public:
     IReader() {}
     virtual ~IReader() = default;
 
+    /* Найти дубликаты и вывести их в std::cout */
     virtual void process(std::shared_ptr<IKeeper> keeper) = 0;
+    /* Найти дубликаты и передать их в sink */
+    virtual void process(std::shared_ptr<IKeeper> keeper, group_sink& sink) = 0;
 };
 
 /**
- * @brief Вспомогательная структура
+ * @brief Параметры сравнения, разрешенные из конфига один раз на запуск Reader
 */
+struct m_file_kind {
+    /* Читать файлы отображением в память */
+    bool mmap;
+    /* Обращение со страничным кэшем */
+    cache_policy policy;
+
+    static m_file_kind from_config(){
+        return m_file_kind{config::Config::instance().reader == "mmap", cache_policy_of_config()};
+    }
+};
+
+/**
+ * @brief Вспомогательная структура.
+ * Размещается вместе с хэшером и источником в арене группы.
+ * Хэшер хранится по значению, его вызовы не виртуальные
+ * @tparam H Алгоритм хэширования из списка hashers
+*/
+template<typename H>
 struct m_file {
 private:
     /* Алгоритм хэширования */
-    std::unique_ptr<ihasher> hasher;
+    H hasher;
+    /* Источник данных файла, открытый на все время сравнения */
+    arena_ptr<isource> source;
 public:
     const boost::filesystem::path& file;
-    unsigned size;
+    std::uint64_t size;
 
-    m_file(const boost::filesystem::path& file_, unsigned size_) : 
-        file(file_), size(size_), blocks_ready(0)
+    m_file(const boost::filesystem::path& file_, std::uint64_t size_, const m_file_kind& kind, group_arena& arena) : 
+        file(file_), size(size_), blocks_ready(0), links(arena.resource()), holes(arena.resource())
     {
-        block_size = config::Config::instance().block;
-        unsigned blocks = (size / block_size);
-        total_blocks = (size % block_size) ? (blocks + 1) : blocks;
-
-        if(config::Config::instance().hash == "crc32"){
-            hasher = std::make_unique<crc32_hasher>();
-        } else if (config::Config::instance().hash == "md5") {
-            hasher = std::make_unique<md5_hasher>();
-        } else {
-            std::cout << "Unknown hasher " + config::Config::instance().hash << std::endl;
-            throw std::exception();
+        const auto& conf = config::Config::instance();
+        block_size   = conf.block;
+        block_max    = std::max(conf.block, conf.block_max);
+        block_growth = std::max<std::size_t>(conf.block_growth, 1);
+
+        /* Кол-во блоков по растущему расписанию */
+        total_blocks = 0;
+        for (std::uint64_t done = 0, block = block_size; done < size; total_blocks++){
+            done += block;
+            block = std::min<std::uint64_t>(block * block_growth, block_max);
         }
 
-        hasher->reset();
+        hasher.reset();
+        source = make_source(file, arena, kind.mmap, kind.policy);
     }
 
     m_file(const m_file&)  = delete;
@@ -51,156 +74,1077 @@ public:
 
     ~m_file() = default;
 
-    unsigned block_size;
+    /* Размер следующего блока. Растет в block_growth раз после каждого блока до block_max */
+    std::size_t block_size;
+    std::size_t block_max;
+    std::size_t block_growth;
     unsigned total_blocks;
     unsigned blocks_ready;
-    unsigned checksum;
+    /* Кол-во уже хэшированных байт */
+    std::uint64_t bytes_ready = 0;
+    digest_t checksum;
+    /* Файл не удалось прочитать, он исключается из сравнения */
+    bool failed = false;
+    /* Подпись файла по выборкам начала, конца и середины */
+    digest_t signature;
+    /* Подпись вычислена или взята из кэша */
+    bool sampled = false;
+    /* Хэши начала файла после 2^i блоков: для сравнения с файлами из кэша */
+    digest_t prefix[cache_record::prefixes];
+    /* Хэши начала prefix[0..known) взяты из кэша, читать файл до них не нужно */
+    unsigned known = 0;
+    /* Подпись взята из кэша */
+    bool signed_cached = false;
+    /* Ключ текущего разбиения группы по одному из prefix */
+    digest_t mark;
+    /* Хэш взят из постоянного кэша, файл не читался */
+    bool cached = false;
+    /* Запись постоянного кэша для этого файла */
+    cache_record cache_key{};
+    /* Физическое смещение начала файла. Известно только на вращающихся дисках */
+    std::uint64_t physical = 0;
+    /* Другие пути к тому же inode. Не читаются, выводятся вместе с файлом */
+    std::pmr::vector<const boost::filesystem::path*> links;
+    /* Дыры разреженного файла [начало, конец). Не читаются, хэшируются как нули */
+    std::pmr::vector<std::pair<std::uint64_t, std::uint64_t>> holes;
 
     /**
-     * @brief Структуры равны, если файлы на которые указывают поля file равны по хэшу от их данных.
-     * Вычисление хэша идет поблочно. До первого несовпадения хэшей.
-     * */
-    bool operator==(m_file& other){
-        if(size != other.size) return false;
-
-        if(blocks_ready != other.blocks_ready){
-            if(blocks_ready < other.blocks_ready){
-                while(blocks_ready != other.blocks_ready){
-                    next_hash();
-                }
-            } else {
-                while(blocks_ready != other.blocks_ready){
-                    other.next_hash();
-                }
-            }
+     * @brief Ищет файл в постоянном кэше. При полной записи весь хэш
+     * считается вычисленным и файл не читается. Из частичной записи
+     * берутся подпись и хэши начала, до которых файл был прочитан раньше
+    */
+    void restore(){
+        struct stat st;
+        if (::stat(file.c_str(), &st) != 0){
+            failed = true;
+            return;
         }
 
-        while (blocks_ready != total_blocks){
-            if(hasher->checksum() != other.hasher->checksum()){
-                return false;
-            }
+        cache_key = cache_record::from_stat(st);
+        cache_record found;
+        if (!hash_cache::instance().lookup(cache_key, found)) return;
+
+        known = std::min<unsigned>(found.depth, cache_record::prefixes);
+        std::copy(std::begin(found.prefix), std::begin(found.prefix) + known, std::begin(prefix));
+        if (found.signed_as(cache_key)){
+            signature     = found.signature;
+            sampled       = true;
+            signed_cached = true;
+        }
 
-            next_hash();
-            other.next_hash();
+        stat_counters& counters = stats::local();
+        if (!(found.flags & cache_record::has_digest)){
+            counters.cache_partial.add();
+            return;
         }
 
-        if(hasher->checksum() == other.hasher->checksum()){
-            return true;
+        checksum     = found.digest;
+        blocks_ready = total_blocks;
+        bytes_ready  = size;
+        cached       = true;
+        counters.cache_hits.add();
+        counters.bytes_done.add(size);
+    }
+
+    /**
+     * @brief Сохраняет в постоянный кэш все, что узнано о файле: хэш целиком,
+     * если файл прочитан до конца, иначе подпись и достигнутые хэши начала
+    */
+    void remember(){
+        if (cached || failed) return;
+
+        /* Хэши начала, посчитанные при чтении или взятые из кэша */
+        unsigned depth = known;
+        while (depth < cache_record::prefixes && (1u << depth) <= blocks_ready) depth++;
+        bool complete = blocks_ready == total_blocks;
+        /* Ничего нового по сравнению с записью в кэше */
+        if (!complete && depth == known && (!sampled || signed_cached)) return;
+
+        cache_record record = cache_key;
+        record.depth = depth;
+        std::copy(std::begin(prefix), std::end(prefix), std::begin(record.prefix));
+        if (complete){
+            record.digest = checksum;
+            record.flags |= cache_record::has_digest;
+        }
+        if (sampled){
+            record.signature = signature;
+            record.flags |= cache_record::has_signature;
         }
+        hash_cache::instance().store(record);
+    }
 
-        return false;
+    /**
+     * @brief Определяет дыры разреженного файла
+    */
+    void layout(){
+        if (find_holes(file, size, holes)) stats::local().sparse_files.add();
     }
 
     /**
-     * @brief Вычислить следующую порцию хэша
+     * @brief Вычислить следующую порцию хэша. Дыры разреженного
+     * файла не читаются, вместо них хэшируются нули
     */
     void next_hash(){
+        std::uint64_t offset;
+        std::size_t rsize;
+        next_block(offset, rsize);
+
+        if (holes.empty()){
+            consume(source->read(offset, rsize), rsize);
+            return;
+        }
+
+        _pieces(offset, rsize, [&](std::uint64_t at, std::size_t len, bool hole){
+            if (!hole){
+                hasher.next_hash(source->read(at, len), len);
+                return;
+            }
+            stats::local().bytes_holes.add(len);
+            hasher.next_zeros(len);
+        });
+        _advance(rsize);
+    }
+
+    /**
+     * @brief Положение следующего блока для хэширования
+     * @arg offset Смещение блока
+     * @arg rsize Размер блока
+    */
+    void next_block(std::uint64_t& offset, std::size_t& rsize) const {
         if (blocks_ready == total_blocks){
-            std::cout << "Уже вычислен весь хэш. Вычислять больше нечего" << std::endl;
+            std::cerr << "Уже вычислен весь хэш. Вычислять больше нечего" << std::endl;
             throw std::exception();
         }
 
-        boost::interprocess::file_mapping m_file(file.string().c_str(), boost::interprocess::read_only);
-        boost::interprocess::mapped_region region(
-            m_file, boost::interprocess::read_only, 
-            blocks_ready * block_size, block_size
-        );
+        offset = bytes_ready;
+        rsize  = std::min<std::uint64_t>(block_size, size - offset);
+    }
+
+    /**
+     * @brief Добавить к хэшу блок, прочитанный по next_block()
+    */
+    void consume(const void* raddr, std::size_t rsize){
+        hasher.next_hash(raddr, rsize);
+        _advance(rsize);
+    }
+
+    /**
+     * @brief Добавить к хэшу часть блока, прочитанного по next_block().
+     * Части подаются по порядку, после последней вызывается finish_block()
+    */
+    void consume_part(const void* raddr, std::size_t len){
+        hasher.next_hash(raddr, len);
+    }
 
-        void * raddr       = region.get_address();
-        std::size_t rsize  = region.get_size();
+    /**
+     * @brief Учесть блок, все части которого добавлены через consume_part()
+     * @arg rsize Размер всего блока
+    */
+    void finish_block(std::size_t rsize){
+        _advance(rsize);
+    }
 
-        hasher->next_hash(raddr, rsize);
-        checksum = hasher->checksum();
+    /**
+     * @brief Дескриптор файла для асинхронного чтения
+     * @return -1, если источник не поддерживает асинхронное чтение
+     * или у файла есть дыры, которые читать не нужно
+    */
+    int descriptor(){
+        if (!holes.empty()) return -1;
+        return source->descriptor();
+    }
+
+    /**
+     * @brief Сообщить об окончании асинхронного чтения
+    */
+    void settle(){
+        source->settle();
+    }
+
+    /**
+     * @brief Вычислить подпись файла: хэш CRC32C от выборок начала, конца
+     * и равномерно расположенных выборок середины файла
+    */
+    void sample(){
+        /* Подпись могла быть вычислена заранее, пока шло сканирование */
+        if (!signature_store::instance().take(file.string(), signature)){
+            signature = sample_signature(*source, size);
+        }
+        sampled = true;
+    }
+
+    /**
+     * @brief Прочитать произвольный участок файла в обход хэша.
+     * Дыры разреженного файла не читаются, а заполняются нулями
+     * @arg buffer Буфер не меньше size байт
+     * @return Адрес прочитанных данных
+    */
+    const void* read(std::uint64_t offset, std::size_t size, char* buffer){
+        if (holes.empty()) return source->read_to(offset, size, buffer);
+
+        _pieces(offset, size, [&](std::uint64_t at, std::size_t len, bool hole){
+            char* to = buffer + (at - offset);
+            if (hole){
+                std::memset(to, 0, len);
+                stats::local().bytes_holes.add(len);
+                return;
+            }
+            const void* data = source->read_to(at, len, to);
+            if (data != to) std::memcpy(to, data, len);
+        });
+        return buffer;
+    }
+
+    /**
+     * @brief Закрыть файл досрочно, когда его дальнейшее чтение не требуется
+    */
+    void release(){
+        source->close();
+    }
+
+private:
+    /**
+     * @brief Обходит участок файла по частям, лежащим целиком в данных или в дыре
+     * @arg fn Вызывается как fn(смещение, длина, дыра ли это)
+    */
+    template<typename F>
+    void _pieces(std::uint64_t offset, std::size_t size, F&& fn) const {
+        const std::uint64_t end = offset + size;
+        auto h = std::partition_point(holes.begin(), holes.end(), [&](const auto& hole){
+            return hole.second <= offset;
+        });
+
+        while (offset < end){
+            if (h == holes.end() || h->first >= end){
+                fn(offset, end - offset, false);
+                break;
+            }
+            if (h->first > offset){
+                fn(offset, h->first - offset, false);
+                offset = h->first;
+            }
+            std::uint64_t stop = std::min(end, h->second);
+            fn(offset, stop - offset, true);
+            offset = stop;
+            h++;
+        }
+    }
+
+    /**
+     * @brief Учитывает хэшированный блок и переходит к следующему
+    */
+    void _advance(std::size_t rsize){
+        checksum = hasher.checksum();
         blocks_ready++;
+        if (std::has_single_bit(blocks_ready) && std::countr_zero(blocks_ready) < static_cast<int>(cache_record::prefixes)){
+            prefix[std::countr_zero(blocks_ready)] = checksum;
+        }
+        bytes_ready += rsize;
+        block_size   = std::min(block_size * block_growth, block_max);
+
+        stat_counters& counters = stats::local();
+        counters.blocks_hashed.add();
+        counters.bytes_hashed.add(rsize);
+        counters.bytes_done.add(rsize);
+
+        /* Файл прочитан полностью - дескриптор больше не нужен */
+        if (blocks_ready == total_blocks) release();
     }
 };
 
-/* Тэг для files_container */
-struct checksum{};
-
-/* Контейнер хранящий указатели на структуры m_file */
-typedef multi_index_container<
-    m_file*,
-    indexed_by<
-        ordered_non_unique<
-            tag<checksum>,  BOOST_MULTI_INDEX_MEMBER(m_file, unsigned, checksum)
-        >
-    >
-> files_container;
+/* Группа файлов, совпадающих по всем вычисленным блокам */
+template<typename H>
+using m_group = std::vector<m_file<H>*>;
+/* Операция над одним файлом раунда */
+template<typename H>
+using file_op = void (*)(m_file<H>*);
+/* Выполняет операцию над всеми файлами раунда: в текущем потоке или на всем пуле */
+template<typename H>
+using round_runner = std::function<void(std::span<m_file<H>* const>, file_op<H>)>;
 
 /**
- * @brief Имплементация IReader
+ * @brief Поиск дубликатов, собранный под один алгоритм хэширования.
+ * Reader выбирает экземпляр по имени алгоритма один раз на запуск
+ * @tparam H Алгоритм хэширования из списка hashers
 */
-class Reader : public IReader {
+template<typename H>
+class basic_reader {
 private:
+    using file_t   = m_file<H>;
+    using group_t  = m_group<H>;
+    using op_t     = file_op<H>;
+    using runner_t = round_runner<H>;
+
+    /* Группы от этого размера хэшируются всеми потоками пула сразу */
+    static constexpr std::size_t _parallel_group = 64;
+    /* Минимальная порция файлов раунда для одного потока */
+    static constexpr std::size_t _min_chunk = 8;
+    /* В режиме auto группы до этого размера сравниваются побайтно */
+    static constexpr std::size_t _bytes_group = 8;
+    /* Размер порции побайтного сравнения */
+    static constexpr std::size_t _bytes_chunk = 1 << 20;
+    /* Предел памяти под буферы побайтного сравнения одной группы */
+    static constexpr std::size_t _bytes_memory = 64 << 20;
+    /* Расположение данных ищется у файлов от этого размера */
+    static constexpr std::uint64_t _sparse_min = 1 << 20;
+    /* Кол-во одновременных чтений io_uring на поток */
+    static constexpr unsigned _uring_depth = 64;
+    /* Размер слота io_uring: блоки больше него читаются несколькими частями */
+    static constexpr std::size_t _uring_slot = 64 << 10;
+
+    /**
+     * @brief Вычисляет следующий блок хэша файла.
+     * Файл, который не удалось прочитать, помечается как failed
+    */
+    static void _next(file_t* f){
+        try {
+            f->next_hash();
+        } catch(const std::exception&) {
+            f->failed = true;
+            f->release();
+        }
+    }
+
+    /**
+     * @brief Определяет дыры разреженного файла
+    */
+    static void _layout(file_t* f){
+        f->layout();
+    }
+
+    /**
+     * @brief Вычисляет подпись файла по выборкам данных.
+     * Файл, который не удалось прочитать, помечается как failed
+    */
+    static void _sample(file_t* f){
+        try {
+            f->sample();
+        } catch(const std::exception&) {
+            f->failed = true;
+            f->release();
+        }
+    }
+
+    /**
+     * @brief Вычисляет следующий блок хэша файлов раунда через io_uring.
+     * Блок делится на части размером со слот кольца, в полете держится
+     * до depth() частей. Части блока хэшируются по порядку: часть,
+     * прочитанная раньше предыдущих, ждет в своем слоте
+    */
+    static void _uring_run(uring& ring, std::span<file_t* const> files){
+        /* Блок одного файла раунда */
+        struct stream {
+            file_t* file;
+            int fd = -1;
+            std::uint64_t offset = 0;
+            std::size_t len = 0;
+            /* Отправлено на чтение и захэшировано байт блока */
+            std::size_t submitted = 0;
+            std::size_t hashed = 0;
+            /* Слоты отправленных частей в порядке смещения */
+            std::deque<unsigned> slots;
+            bool failed = false;
+            bool done = false;
+        };
+        /* Часть блока в слоте */
+        struct piece {
+            stream* owner;
+            std::size_t at;
+            std::size_t len;
+            bool ready;
+        };
+
+        std::vector<stream> streams;
+        streams.reserve(files.size());
+        std::vector<piece> pieces(ring.depth());
+        std::size_t next = 0;
+
+        /* Следующий файл, блок которого читается через кольцо. Остальные хэшируются сразу */
+        auto open = [&]() -> stream* {
+            while (next < files.size()){
+                file_t* f = files[next++];
+                try {
+                    stream s{f};
+                    f->next_block(s.offset, s.len);
+                    s.fd = f->descriptor();
+                    if (s.fd >= 0){
+                        streams.push_back(std::move(s));
+                        return &streams.back();
+                    }
+                    _next(f);
+                } catch(const std::exception&) {
+                    f->failed = true;
+                    f->release();
+                }
+            }
+            return nullptr;
+        };
+
+        /* Хэширует готовые по порядку части и завершает блок, когда части кончились */
+        auto drain = [&](stream& s){
+            while (!s.slots.empty() && pieces[s.slots.front()].ready){
+                unsigned slot = s.slots.front();
+                s.slots.pop_front();
+                if (!s.failed) s.file->consume_part(ring.buffer(slot), pieces[slot].len);
+                s.hashed += pieces[slot].len;
+                ring.release(slot);
+            }
+            if (s.done || !s.slots.empty() || (!s.failed && s.hashed < s.len)) return;
+
+            s.done = true;
+            try {
+                s.file->settle();
+                if (!s.failed){
+                    s.file->finish_block(s.len);
+                    return;
+                }
+            } catch(const std::exception&) {}
+            s.file->failed = true;
+            s.file->release();
+        };
+
+        stream* cur = open();
+        unsigned inflight = 0;
+        unsigned slot;
+        int res;
+
+        while (cur != nullptr || inflight > 0){
+            while (cur != nullptr && (cur->failed || cur->submitted == cur->len)){
+                cur = open();
+            }
+            while (cur != nullptr && ring.acquire(slot)){
+                std::size_t len = std::min(ring.buffer_size(), cur->len - cur->submitted);
+                ring.read(slot, cur->fd, cur->offset + cur->submitted, len);
+                pieces[slot] = piece{cur, cur->submitted, len, false};
+                cur->slots.push_back(slot);
+                cur->submitted += len;
+                inflight++;
+                if (cur->submitted == cur->len) cur = open();
+            }
+
+            if (inflight == 0) continue;
+            ring.submit_and_wait();
+
+            while (ring.reap(slot, res)){
+                piece& p = pieces[slot];
+                stream& s = *p.owner;
+                inflight--;
+
+                try {
+                    if (res < 0) throw std::system_error(-res, std::generic_category());
+
+                    stat_counters& counters = stats::local();
+                    counters.reads.add();
+                    counters.bytes_read.add(res);
+
+                    /* Короткое чтение дочитывается синхронно */
+                    std::size_t done = static_cast<std::size_t>(res);
+                    if (done < p.len){
+                        s.file->read(s.offset + p.at + done, p.len - done, ring.buffer(slot) + done);
+                    }
+                } catch(const std::exception&) {
+                    s.failed = true;
+                }
+                p.ready = true;
+                drain(s);
+            }
+        }
+    }
+
+    /**
+     * @brief Выполняет операцию над всеми файлами раунда в текущем потоке.
+     * Хэширование при --reader uring идет через io_uring, если он доступен.
+     * Файлы с известным физическим смещением читаются в порядке расположения на диске
+    */
+    static void _run(std::span<file_t* const> files, op_t op){
+        std::vector<file_t*> ordered;
+        if (files.size() > 1 && std::any_of(files.begin(), files.end(), [](file_t* f){ return f->physical != 0; })){
+            ordered.assign(files.begin(), files.end());
+            std::stable_sort(ordered.begin(), ordered.end(), [](file_t* a, file_t* b){
+                return a->physical < b->physical;
+            });
+            files = ordered;
+        }
+
+        const auto& conf = config::Config::instance();
+        if (op == _next && conf.reader == "uring" && !files.empty()){
+            if (uring* ring = uring::local(_uring_depth, _uring_slot)){
+                _uring_run(*ring, files);
+                return;
+            }
+        }
+
+        for (auto f : files){
+            op(f);
+        }
+    }
+
+    /**
+     * @brief Разбивает группу по значению хэша. Подгруппы из одного файла
+     * отбрасываются сразу, их файлы закрываются
+     * @arg group Группа файлов, у которых вычислено одинаковое кол-во блоков
+     * @arg out Куда сложить подгруппы из двух и более файлов
+     * @arg key Поле m_file, по которому разбивается группа
+    */
+    static void _split(group_t& group, std::vector<group_t>& out, digest_t file_t::* key = &file_t::checksum){
+        stat_counters& counters = stats::local();
+        std::erase_if(group, [&](file_t* f){
+            if (f->failed){
+                counters.failed.add();
+                counters.bytes_done.add(f->size - f->bytes_ready);
+            }
+            return f->failed;
+        });
+        std::sort(group.begin(), group.end(), [key](file_t* a, file_t* b){
+            return a->*key < b->*key;
+        });
+
+        auto start = group.begin();
+        while (start != group.end()){
+            auto end = std::find_if(start, group.end(), [&](file_t* f){
+                return f->*key != (*start)->*key;
+            });
+
+            if (std::distance(start, end) > 1){
+                out.emplace_back(start, end);
+            } else {
+                file_t* f = *start;
+                if (key == &file_t::signature){
+                    counters.eliminated_sample.add();
+                } else {
+                    counters.eliminated_depth[std::min<std::size_t>(
+                        std::max(f->blocks_ready, 1u) - 1, stat_counters::depths - 1
+                    )].add();
+                }
+                counters.bytes_done.add(f->size - f->bytes_ready);
+                f->release();
+            }
+            start = end;
+        }
+    }
+
+    /**
+     * @brief Поблочное разбиение группы файлов одинакового размера.
+     * Каждый раунд вычисляет следующий блок всех файлов, оставшихся
+     * в игре, и разбивает группы по значению хэша. Каждый блок файла
+     * читается не более одного раза, уникальные файлы перестают читаться сразу
+     * @arg run Исполнитель раундов
+     * @return Группы дубликатов
+    */
+    static std::vector<group_t> _refine(group_t group, const runner_t& run){
+        std::vector<group_t> active, done;
+        active.push_back(std::move(group));
+
+        while (!active.empty()){
+            std::vector<file_t*> round;
+            std::vector<group_t> next;
+
+            for (auto& g : active){
+                /* Файлы группы одного размера, поэтому и блоков у них поровну */
+                if (g.front()->blocks_ready == g.front()->total_blocks){
+                    done.push_back(std::move(g));
+                } else {
+                    round.insert(round.end(), g.begin(), g.end());
+                    next.push_back(std::move(g));
+                }
+            }
+
+            run(round, _next);
+
+            active.clear();
+            for (auto& g : next){
+                _split(g, active);
+            }
+        }
+
+        return done;
+    }
+
+    /**
+     * @brief Побайтное сравнение группы файлов одинакового размера без хэширования.
+     * Все файлы читаются синхронно большими порциями, на каждой порции группа
+     * разбивается по содержимому (memcmp), файлы ставшие уникальными закрываются
+     * @return Группы дубликатов
+    */
+    static std::vector<group_t> _compare_bytes(group_t group){
+        if (group.empty()) return {};
+
+        std::uint64_t size = group.front()->size;
+        std::size_t chunk  = std::clamp<std::size_t>(_bytes_memory / group.size(), 4096, _bytes_chunk);
+        std::unique_ptr<char[]> buffers(new char[chunk * group.size()]);
+
+        std::vector<group_t> active;
+        active.push_back(std::move(group));
+        stat_counters& counters = stats::local();
+
+        for (std::uint64_t offset = 0; offset < size && !active.empty(); offset += chunk){
+            std::size_t len = std::min<std::uint64_t>(chunk, size - offset);
+            std::vector<group_t> next;
+
+            for (auto& g : active){
+                /* Классы содержимого порции: образец данных и файлы с таким же содержимым */
+                std::vector<std::pair<const void*, group_t>> classes;
+
+                for (std::size_t i = 0; i < g.size(); i++){
+                    const void* data;
+                    try {
+                        data = g[i]->read(offset, len, buffers.get() + i * chunk);
+                    } catch(const std::exception&) {
+                        g[i]->release();
+                        counters.failed.add();
+                        counters.bytes_done.add(size - offset);
+                        continue;
+                    }
+                    counters.bytes_compared.add(len);
+                    counters.bytes_done.add(len);
+
+                    auto cls = std::find_if(classes.begin(), classes.end(), [&](const auto& c){
+                        return std::memcmp(c.first, data, len) == 0;
+                    });
+                    if (cls == classes.end()){
+                        classes.emplace_back(data, group_t{g[i]});
+                    } else {
+                        cls->second.push_back(g[i]);
+                    }
+                }
+
+                for (auto& c : classes){
+                    if (c.second.size() > 1){
+                        next.push_back(std::move(c.second));
+                    } else {
+                        c.second.front()->release();
+                        counters.eliminated_bytes.add();
+                        counters.bytes_done.add(size - offset - len);
+                    }
+                }
+            }
+
+            active.swap(next);
+        }
+
+        for (auto& g : active){
+            for (auto f : g) f->release();
+        }
+        return active;
+    }
+
+    /**
+     * @brief Дочитывает файлы группы без разбиения до blocks блоков или до конца.
+     * Нужно, когда часть файлов группы взята из постоянного кэша:
+     * сравнивать с ними можно только хэши, сохраненные в кэше
+    */
+    static void _complete(const group_t& group, const runner_t& run,
+        unsigned blocks = std::numeric_limits<unsigned>::max())
+    {
+        std::vector<file_t*> round;
+        do {
+            round.clear();
+            for (auto f : group){
+                if (!f->failed && f->blocks_ready < std::min(blocks, f->total_blocks)) round.push_back(f);
+            }
+            run(round, _next);
+        } while (!round.empty());
+    }
+
+    /**
+     * @brief Сравнивает группу, часть файлов которой есть в постоянном кэше.
+     * Файлы из кэша не читаются. Группа разбивается по подписи и по хэшам
+     * начала после 1, 2, 4, ... блоков; в каждой точке читаются только файлы,
+     * хэш которых в ней не известен из кэша. Подгруппы, которым кэш больше
+     * не помогает, разбиваются как обычно. До конца дочитываются только
+     * новые файлы, совпавшие с полной записью кэша во всех точках
+     * @arg run Исполнитель раундов
+     * @arg duplicates Куда сложить найденные группы дубликатов
+    */
+    static void _compare_cached(group_t group, const runner_t& run, std::vector<group_t>& duplicates){
+        /* В подгруппе есть файл, хэш которого в точке i (или целиком) известен из кэша */
+        auto has_known = [](const group_t& g, unsigned i){
+            return std::any_of(g.begin(), g.end(), [i](file_t* f){ return f->cached || f->known > i; });
+        };
+        /* _refine ждет одинаковое кол-во блоков у файлов группы, а файлы с хэшами из кэша не читались */
+        auto refine = [&](group_t g){
+            unsigned blocks = 0;
+            for (auto f : g) blocks = std::max(blocks, f->blocks_ready);
+            _complete(g, run, blocks);
+            auto found = _refine(std::move(g), run);
+            std::move(found.begin(), found.end(), std::back_inserter(duplicates));
+        };
+
+        std::vector<group_t> active;
+        bool signed_all = std::all_of(group.begin(), group.end(), [](file_t* f){ return !f->cached || f->sampled; });
+        if (signature_worthwhile(group.front()->size) && signed_all){
+            group_t unsigned_files;
+            std::copy_if(group.begin(), group.end(), std::back_inserter(unsigned_files), [](file_t* f){ return !f->sampled; });
+            run(unsigned_files, _sample);
+            _split(group, active, &file_t::signature);
+        } else {
+            active.push_back(std::move(group));
+        }
+
+        for (unsigned i = 0; i < cache_record::prefixes; i++){
+            const unsigned blocks = 1u << i;
+            std::vector<group_t> next;
+            for (auto& g : active){
+                if (!has_known(g, i)){
+                    refine(std::move(g));
+                } else if (blocks > g.front()->total_blocks){
+                    next.push_back(std::move(g));
+                } else {
+                    group_t unknown;
+                    std::copy_if(g.begin(), g.end(), std::back_inserter(unknown), [i](file_t* f){ return !f->cached && f->known <= i; });
+                    _complete(unknown, run, blocks);
+                    for (auto f : g) f->mark = f->prefix[i];
+                    _split(g, next, &file_t::mark);
+                }
+            }
+            active.swap(next);
+        }
+
+        for (auto& g : active){
+            if (!std::any_of(g.begin(), g.end(), [](file_t* f){ return f->cached; })){
+                refine(std::move(g));
+                continue;
+            }
+            _complete(g, run);
+            _split(g, duplicates);
+        }
+    }
+
+    /**
+     * @brief Выполняет операцию над файлами раунда на потоках пула.
+     * Раунд делится на порции, одну из которых считает вызывающий поток
+     * @arg limit Наибольшее кол-во потоков, читающих раунд одновременно
+    */
+    static void _parallel_run(boost::asio::thread_pool& pool, std::span<file_t* const> files, op_t op,
+        std::size_t limit)
+    {
+        if (files.empty()) return;
+
+        std::size_t chunks = std::clamp<std::size_t>(
+            files.size() / _min_chunk, 1, std::min(config::Config::instance().threads * 4, limit)
+        );
+        std::size_t chunk = (files.size() + chunks - 1) / chunks;
+        chunks = (files.size() + chunk - 1) / chunk;
+
+        std::latch ready(chunks - 1);
+        for (std::size_t i = 1; i < chunks; i++){
+            boost::asio::post(pool, [&, i](){
+                _run(files.subspan(i * chunk, std::min(chunk, files.size() - i * chunk)), op);
+                ready.count_down();
+            });
+        }
+
+        _run(files.first(std::min(chunk, files.size())), op);
+        ready.wait();
+    }
+
+    /**
+     * @brief Разбивает группу по подписи из выборок начала, конца и середины файлов.
+     * До полного сравнения доходят только файлы, совпавшие по подписи
+     * @arg run Исполнитель раундов
+     * @return Группы файлов с одинаковой подписью
+    */
+    static std::vector<group_t> _prefilter(group_t group, const runner_t& run){
+        std::vector<group_t> out;
+        run(group, _sample);
+        _split(group, out, &file_t::signature);
+        return out;
+    }
+
+    /**
+     * @brief Сравнивать ли группу побайтно, а не хэшами.
+     * Вывод jsonl содержит хэш группы, а постоянный кэш и режим наблюдения хранят
+     * хэши файлов для следующих сравнений, поэтому в этих случаях режим auto хэширует группы
+    */
+    static bool _by_bytes(std::size_t files){
+        const auto& conf = config::Config::instance();
+        const std::string& mode = conf.compare;
+        if (mode == "auto" && (conf.format == "jsonl" || hash_cache::instance().enabled())) return false;
+        return mode == "bytes" || (mode == "auto" && files <= _bytes_group);
+    }
+
+    /**
+     * @brief Сравнивает файлы группы одинакового размера
+     * @arg group Файлы группы, не меньше двух
+     * @arg run Исполнитель раундов
+     * @arg device Устройство, на котором лежат файлы группы
+     * @arg duplicates Куда сложить найденные группы дубликатов
+    */
+    static void _compare(group_t group, const runner_t& run, const io_device& device, std::vector<group_t>& duplicates){
+        if (device.rotational){
+            for (auto f : group) f->physical = physical_offset(f->file);
+        }
+
+        auto& cache = hash_cache::instance();
+        if (cache.enabled()){
+            for (auto f : group) f->restore();
+        }
+
+        /* Дыры ищутся только у файлов, которые будут читаться. Поиск - несколько
+           системных вызовов без чтения данных, и идет в текущем потоке: holes
+           выделяется в арене группы, которая не потокобезопасна */
+        if (config::Config::instance().sparse && group.front()->size >= _sparse_min){
+            group_t unread;
+            std::copy_if(group.begin(), group.end(), std::back_inserter(unread), [](file_t* f){
+                return !f->cached && !f->failed;
+            });
+            _run(unread, _layout);
+        }
+
+        if (std::any_of(group.begin(), group.end(), [](file_t* f){ return f->cached || f->known > 0 || f->signed_cached; })){
+            _compare_cached(std::move(group), run, duplicates);
+            return;
+        }
+
+        std::vector<group_t> candidates;
+        if (signature_worthwhile(group.front()->size)){
+            candidates = _prefilter(std::move(group), run);
+        } else {
+            candidates.push_back(std::move(group));
+        }
+
+        for (auto& g : candidates){
+            auto found = _by_bytes(g.size()) ? _compare_bytes(std::move(g)) : _refine(std::move(g), run);
+            std::move(found.begin(), found.end(), std::back_inserter(duplicates));
+        }
+    }
+
     /**
      * @brief Выполняет основную работу по поиску дубликатов.
+     * @arg iters Группа файлов одинакового размера. Файлы группы живут, пока жива iters
+     * @arg run Исполнитель раундов
+     * @arg sink Получатель найденных групп
+     * @arg kind Параметры сравнения файлов
+     * @arg device Устройство, на котором лежат файлы группы
     */
-    static void _process(std::pair<iter_t, iter_t> iters){
-        auto distance = boost::distance(iters.first, iters.second);
+    static void _process(file_group iters, const runner_t& run, group_sink& sink, const m_file_kind& kind,
+        const io_device& device)
+    {
+        auto distance = std::distance(iters.first, iters.second);
         if(distance <= 1) return;
 
-        files_container files;
+        /* Арена объявлена первой: файлы группы разрушаются раньше, чем освобождается ее память */
+        group_arena arena;
+        std::pmr::vector<arena_ptr<file_t>> files(arena.resource());
+        group_t group;
+        files.reserve(distance);
+        group.reserve(distance);
 
-        // Сравнить каждый файл с каждым, что приведет к
-        // вычислению достаточного кол-ва блоков хэшей. 
-        // И после этого закинуть в контейнер для дальнейшей 
-        // группировки по значению хэша
-        m_file* elem;
-        while(iters.first != iters.second){
-            elem = new m_file(iters.first->path, iters.first->size);
-            for(auto it = files.begin(); it != files.end(); it++){
-                (**it == *elem);
+        /* Пути одного inode (жесткие ссылки, пересекающиеся include) читаются один раз */
+        std::pmr::map<std::pair<std::uint64_t, std::uint64_t>, file_t*> inodes(arena.resource());
+        stat_counters& counters = stats::local();
+
+        for (; iters.first != iters.second; iters.first++){
+            const file_entry& e = *iters.first;
+            if (e.ino != 0){
+                auto it = inodes.find({e.dev, e.ino});
+                if (it != inodes.end()){
+                    it->second->links.push_back(&e.path);
+                    counters.hardlinks.add();
+                    counters.bytes_done.add(e.size);
+                    continue;
+                }
+            }
+
+            files.push_back(arena.make<file_t>(e.path, e.size, kind, arena));
+            group.push_back(files.back().get());
+            if (e.ino != 0) inodes.emplace(std::make_pair(e.dev, e.ino), group.back());
+        }
+
+        std::vector<group_t> duplicates;
+        if (group.size() > 1){
+            _compare(std::move(group), run, device, duplicates);
+            if (hash_cache::instance().enabled()){
+                for (auto& f : files) f->remember();
+            }
+        }
+
+        const std::string& hardlinks = config::Config::instance().hardlinks;
+        for (auto& g : duplicates){
+            auto out = std::make_unique<dup_group>();
+            file_t* first = g.front();
+            out->size       = first->size;
+            out->digest     = first->checksum;
+            out->has_digest = first->total_blocks > 0 && first->blocks_ready == first->total_blocks;
+            out->paths.reserve(g.size());
+            for (auto f : g){
+                out->paths.push_back(f->file.string());
+                /* Ссылки на тот же inode - такие же дубликаты */
+                if (hardlinks == "merge"){
+                    for (auto link : f->links) out->paths.push_back(link->string());
+                    f->links.clear();
+                }
             }
 
-            files.insert(elem);
-            iters.first++;
+            counters.duplicate_groups.add();
+            counters.duplicate_files.add(out->paths.size());
+            sink.push(std::move(out));
         }
 
-        // Группировать по значению хэша
-        const typename boost::multi_index::index<
-            files_container, checksum
-        >::type& filesByHash = get<checksum>(files);
+        /* Ссылки на один inode, не попавшие в группы дубликатов */
+        if (hardlinks == "ignore") return;
+        for (auto& f : files){
+            if (f->links.empty()) continue;
 
-        auto start = filesByHash.begin();
-        auto end   = filesByHash.end();
+            auto out = std::make_unique<dup_group>();
+            out->size       = f->size;
+            out->has_digest = false;
+            out->hardlinked = hardlinks == "separate";
+            out->paths.push_back(f->file.string());
+            for (auto link : f->links) out->paths.push_back(link->string());
 
-        boost::unique_lock<boost::mutex> scoped_lock(io_mutex);
+            counters.duplicate_groups.add();
+            counters.duplicate_files.add(out->paths.size());
+            sink.push(std::move(out));
+        }
+    }
+public:
+    /**
+     * @brief Итерируется по группам файлов с одинаковым размером 
+     * из IKeeper и для каждой группы запускает поток для поиска дубликатов.
+     * Одновременно обрабатывается не больше групп устройства, чем его лимит,
+     * остальные ждут в очереди устройства. Большие группы твердотельных
+     * устройств обрабатываются вызывающим потоком, а каждый их раунд
+     * хэшируется всеми потоками пула
+     * @arg keeper Хранилище подготовленных файлов
+     * @arg sink Получатель найденных групп
+     */
+    static void process(std::shared_ptr<IKeeper> keeper, group_sink& sink){
+        const auto& conf = config::Config::instance();
+        const m_file_kind kind = m_file_kind::from_config();
+        boost::asio::thread_pool pool(conf.threads);
+        std::vector<std::pair<file_group, const io_device*>> large;
+
+        /* С лимитом памяти группы не копятся в очереди пула: их читают с диска потоком */
+        const bool bounded = conf.memory_limit > 0;
+        const std::size_t max_queued = std::max<std::size_t>(conf.threads, 1) * 4;
+        std::atomic<std::size_t> queued{0};
+
+        /* Очередь устройства: группы сверх его лимита ждут окончания одной из запущенных */
+        struct device_queue {
+            std::size_t running = 0;
+            std::deque<std::function<void()>> pending;
+        };
+        std::mutex devices_mutex;
+        /* Сигнал, что у устройства не осталось запущенных групп */
+        std::condition_variable devices_idle;
+        std::unordered_map<const io_device*, device_queue> devices;
 
-        while(start != end){
-            auto _iters = filesByHash.equal_range((*start)->checksum);
+        auto schedule = [&](const io_device& device, std::function<void()> task){
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            auto& q = devices[&device];
+            if (q.running < device.limit){
+                q.running++;
+                boost::asio::post(pool, std::move(task));
+            } else {
+                q.pending.push_back(std::move(task));
+            }
+        };
+
+        auto finish = [&](const io_device& device){
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            auto& q = devices[&device];
+            if (q.pending.empty()){
+                if (--q.running == 0) devices_idle.notify_all();
+                return;
+            }
+            boost::asio::post(pool, std::move(q.pending.front()));
+            q.pending.pop_front();
+        };
+
+        /* Большая группа занимает все места устройства: ее раунды читают до limit потоков,
+           и другие группы устройства ждут в очереди, пока она не закончится */
+        auto run_large = [&](const file_group& iters, const io_device& device){
+            {
+                std::unique_lock<std::mutex> lock(devices_mutex);
+                auto& q = devices[&device];
+                devices_idle.wait(lock, [&q](){ return q.running == 0; });
+                q.running = device.limit;
+            }
+
+            _process(iters, [&pool, &device](std::span<file_t* const> files, op_t op){
+                _parallel_run(pool, files, op, device.limit);
+            }, sink, kind, device);
+
+            std::lock_guard<std::mutex> lock(devices_mutex);
+            auto& q = devices[&device];
+            q.running = 0;
+            while (q.running < device.limit && !q.pending.empty()){
+                q.running++;
+                boost::asio::post(pool, std::move(q.pending.front()));
+                q.pending.pop_front();
+            }
+            if (q.running == 0) devices_idle.notify_all();
+        };
 
-            if(std::distance(_iters.first, _iters.second) > 1){
-                while(_iters.first != _iters.second){
-                    std::cout << (*_iters.first)->file << std::endl;        
-                    _iters.first++;
+        {
+            phase_timer timer("group");
+            /* Файлы уникальных по размеру групп не нужны, их пути не восстанавливаются */
+            for(auto iters : keeper->group_by_size(2)){
+                std::size_t files = iters.count;
+                stats::instance().add_group(files, iters.size);
+
+                if (files < 2) continue;
+                const io_device& device = device_table::instance().of_files(iters.first, iters.second);
+
+                /* Вращающийся диск не выигрывает от параллельного чтения большой группы */
+                if (files >= _parallel_group && !device.rotational){
+                    if (bounded) run_large(iters, device);
+                    else large.push_back({iters, &device});
+                    continue;
                 }
-                std::cout << std::endl;
+
+                if (bounded){
+                    std::size_t n;
+                    while ((n = queued.load(std::memory_order_acquire)) >= max_queued){
+                        queued.wait(n, std::memory_order_acquire);
+                    }
+                }
+                queued.fetch_add(1, std::memory_order_relaxed);
+                schedule(device, [iters, &device, &sink, &queued, &kind, &finish](){
+                    _process(iters, _run, sink, kind, device);
+                    finish(device);
+                    queued.fetch_sub(1, std::memory_order_release);
+                    queued.notify_one();
+                });
             }
-            start = _iters.second;
         }
 
-        for (auto v : files){
-            delete v;
+        for (auto& [iters, device] : large){
+            run_large(iters, *device);
         }
+
+        pool.join();
+        /* Подписи файлов, группы которых сравнивались без выборок, больше не нужны */
+        signature_store::instance().clear();
     }
+};
 
+/**
+ * @brief Имплементация IReader
+*/
+class Reader : public IReader {
 public:
     Reader() = default;
     ~Reader() = default;
 
     /**
-     * @brief Итерируется по группам файлов с одинаковым размером 
-     * из IKeeper и для каждой группы запускает поток для поиска дубликатов
+     * @brief Выбирает экземпляр basic_reader по алгоритму из конфига
+     * и передает ему всю работу
      * @arg keeper Хранилище подготовленных файлов
+     * @arg sink Получатель найденных групп
      */
-    void process(std::shared_ptr<IKeeper> keeper) override {
-        boost::asio::thread_pool pool(config::Config::instance().threads);
-        
-        for(auto iters : keeper->group_by_size()){
-            boost::asio::post(pool, boost::bind(Reader::_process, iters));
+    void process(std::shared_ptr<IKeeper> keeper, group_sink& sink) override {
+        const std::string& name = config::Config::instance().hash;
+        if (!with_hasher(name, [&]<typename H>(){ basic_reader<H>::process(keeper, sink); })){
+            std::cerr << "Unknown hasher " + name << std::endl;
+            throw std::exception();
         }
+    }
 
-        pool.join();
+    void process(std::shared_ptr<IKeeper> keeper) override {
+        result_writer writer(std::cout, config::Config::instance().format);
+        process(keeper, writer);
     }
 };
@@ -17,85 +17,232 @@ public:
 };
 
 /**
- * @brief Реализация IScaner
+ * @brief Пул потоков с очередью задач у каждого потока.
+ * Поток берет задачи с конца своей очереди, а когда она пуста -
+ * ворует задачи с начала очередей других потоков
 */
-class Scaner : public IScaner {
+template<typename Task>
+class work_stealing_pool {
 private:
-    const bool& _r; 
-    const std::set<boost::filesystem::path>& _inc;
-    const std::set<boost::filesystem::path>& _exc;
-    const unsigned _filesize;
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<worker_queue> _queues;
+    /* Кол-во задач в очередях и в работе */
+    std::atomic<std::size_t> _pending{0};
+    /* Первое исключение обработчика; после него потоки перестают брать задачи */
+    std::exception_ptr _failure;
+    std::mutex _failure_mutex;
+    std::atomic<bool> _stop{false};
+
+    bool _pop(std::size_t self, Task& task){
+        {
+            std::lock_guard<std::mutex> lock(_queues[self].mutex);
+            if (!_queues[self].tasks.empty()){
+                task = std::move(_queues[self].tasks.back());
+                _queues[self].tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < _queues.size(); i++){
+            auto& victim = _queues[(self + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()){
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+    explicit work_stealing_pool(std::size_t threads) : _queues(std::max<std::size_t>(threads, 1)) {}
 
     /**
-     * @brief Вызывается рекурсивно (если позволено в конфиге) для 
-     * каждой директории, проверяет файлы в директориях на соответствие
-     * заданным фильтрам, складывает файлы, прошедшие фильтры в _keeper
-     * базового класса
-     * @arg it Указатель на начало директории
-     * @arg end Указатель на конец директории
+     * @brief Кладет задачу в очередь потока
+     * @arg worker Номер потока, в очередь которого кладется задача
     */
-    void _scan(auto& it, auto& end){
-        namespace fs = boost::filesystem;
-
-        for(; it != end; ++it){
-            switch (fs::status(*it).type())
-            {
-            case fs::regular_file:
-                /* Фильтр по размеру файла */
-                if(fs::file_size(it->path()) < _filesize) continue;;
-
-                if(config::Config::instance().masks.size() > 0){
-                    /* Фильтр по маскам разрешенных имен */
-                    for(auto mask : config::Config::instance().masks){
-                        std::string s = it->path().filename().string();
-                        boost::to_lower(s);
-                        if(boost::contains(s, mask)){
-                            _keeper->add_file(it->path(), fs::file_size(it->path()));
-                        };
+    void push(std::size_t worker, Task task){
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(_queues[worker % _queues.size()].mutex);
+        _queues[worker % _queues.size()].tasks.push_back(std::move(task));
+    }
+
+    /**
+     * @brief Выполняет задачи, пока они не закончатся
+     * @arg fn Обработчик задачи, вызывается как fn(номер потока, задача).
+     * Может класть новые задачи через push().
+     * Исключение обработчика останавливает пул и пробрасывается из run()
+     * после завершения всех потоков, оставшиеся задачи отбрасываются
+    */
+    template<typename Fn>
+    void run(Fn fn){
+        std::vector<std::thread> threads;
+
+        for (std::size_t self = 0; self < _queues.size(); self++){
+            threads.emplace_back([this, self, &fn](){
+                Task task;
+                unsigned idle = 0;
+
+                while (_pending.load(std::memory_order_acquire) != 0 && !_stop.load(std::memory_order_acquire)){
+                    if (_pop(self, task)){
+                        try {
+                            fn(self, task);
+                        } catch(...) {
+                            std::lock_guard<std::mutex> lock(_failure_mutex);
+                            if (!_failure) _failure = std::current_exception();
+                            _stop.store(true, std::memory_order_release);
+                        }
+                        _pending.fetch_sub(1, std::memory_order_acq_rel);
+                        idle = 0;
+                    } else if (++idle < 64){
+                        std::this_thread::yield();
+                    } else {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
                     }
-                } else {
-                    _keeper->add_file(it->path(), fs::file_size(it->path()));
                 }
-                break;
+            });
+        }
 
-            case fs::directory_file:
-                if (_r){
-                    if(_exc.find(it->path()) == _exc.end()){
-                        boost::filesystem::directory_iterator it_r(it->path()); 
-                        _scan(it_r, end);
-                    }
+        for (auto& t : threads){
+            t.join();
+        }
+
+        if (_failure){
+            for (auto& q : _queues) q.tasks.clear();
+            _pending.store(0, std::memory_order_relaxed);
+            _stop.store(false, std::memory_order_relaxed);
+            std::rethrow_exception(std::exchange(_failure, nullptr));
+        }
+    }
+};
+
+/**
+ * @brief Реализация IScaner.
+ * Директории обходятся параллельно на work_stealing_pool,
+ * каждый элемент директории проверяется не более чем одним stat
+*/
+class Scaner : public IScaner {
+private:
+    /* Размер пачки файлов, передаваемой в _keeper за один раз */
+    static constexpr std::size_t _batch_size = 1024;
+
+    const bool& _r;
+    const std::set<boost::filesystem::path>& _inc;
+    const std::uint64_t _filesize;
+    /* Маски и исключения, собранные один раз */
+    const scan_filter _filter;
+
+    static void _error(const boost::filesystem::path& path, int code){
+        boost::unique_lock<boost::mutex> scoped_lock(io_mutex);
+        std::cerr << "filesystem's error:\n"
+            << "    code: " << code << '\n'
+            << "    what happens: " << path << ": " << std::strerror(code) << '\n';
+    }
+
+    /**
+     * @brief Сканирует одну директорию: файлы, прошедшие фильтры,
+     * складываются в batch, поддиректории (если позволено в конфиге)
+     * отправляются в пул
+     * @arg pool Пул обхода директорий
+     * @arg self Номер потока пула
+     * @arg dir Директория для сканирования
+     * @arg batch Накопленные потоком файлы для _keeper
+    */
+    void _scan(work_stealing_pool<boost::filesystem::path>& pool, std::size_t self,
+        const boost::filesystem::path& dir, std::vector<file_entry>& batch)
+    {
+        int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* d  = (dfd < 0) ? nullptr : ::fdopendir(dfd);
+        if (d == nullptr){
+            _error(dir, errno);
+            if (dfd >= 0) ::close(dfd);
+            return;
+        }
+
+        stat_counters& counters = stats::local();
+        counters.dirs.add();
+
+        while (struct dirent* e = ::readdir(d)){
+            if (std::strcmp(e->d_name, ".") == 0 || std::strcmp(e->d_name, "..") == 0) continue;
+
+            unsigned char type = e->d_type;
+            counters.entries.add();
+
+            /* Имя не проходит по маскам - stat не нужен */
+            if (type == DT_REG && !_filter.name(e->d_name)){
+                counters.filtered_mask.add();
+                continue;
+            }
+            if (type == DT_DIR && !_r) continue;
+
+            struct stat st;
+            if (type != DT_DIR){
+                /* Размер файла и цель ссылки известны только из stat */
+                counters.stat_calls.add();
+                if (::fstatat(dfd, e->d_name, &st, 0) != 0) continue;
+                if (S_ISREG(st.st_mode))      type = DT_REG;
+                else if (S_ISDIR(st.st_mode)) type = DT_DIR;
+                else continue;
+            }
+
+            boost::filesystem::path path = dir / e->d_name;
+
+            if (type == DT_REG){
+                /* Фильтр по размеру файла и маскам разрешенных имен */
+                if (static_cast<std::uintmax_t>(st.st_size) < _filesize){
+                    counters.filtered_size.add();
+                    continue;
+                }
+                if (e->d_type != DT_REG && !_filter.name(e->d_name)){
+                    counters.filtered_mask.add();
+                    continue;
                 }
-                break;
 
-            default: break;
+                counters.files_added.add();
+                batch.emplace_back(std::move(path), st.st_size, st.st_dev, st.st_ino);
+                if (batch.size() >= _batch_size){
+                    _keeper->add_files(batch);
+                    batch.clear();
+                }
+            } else if (_r && !_filter.excluded(path)){
+                pool.push(self, std::move(path));
             }
         }
+
+        ::closedir(d);
     }
 
 public:
-
-    Scaner(std::shared_ptr<IKeeper> keeper) : 
+    Scaner(std::shared_ptr<IKeeper> keeper) :
         _r(config::Config::instance().level),
         _inc(config::Config::instance().includes),
-        _exc(config::Config::instance().excludes),
         _filesize(config::Config::instance().minfile),
+        _filter(scan_filter::from_config()),
         IScaner(keeper)
     {}
 
     void collect() override {
-        namespace fs = boost::filesystem;
-
-        for (auto path: _inc){
-            try{
-                boost::filesystem::directory_iterator begin(path);
-                boost::filesystem::directory_iterator end;
-                _scan(begin, end);
-            } catch(const boost::filesystem::filesystem_error& ex) {
-                std::cout << "filesystem's error:\n"
-                    << "    code: " << ex.code().value() << '\n'
-                    << "    category: " << ex.code().category().name() << '\n'
-                    << "    what happens: " << ex.what() << '\n';
-            }
+        std::size_t threads = config::Config::instance().threads;
+        work_stealing_pool<boost::filesystem::path> pool(threads);
+        std::vector<std::vector<file_entry>> batches(std::max<std::size_t>(threads, 1));
+
+        std::size_t worker = 0;
+        for (const auto& path : _filter.roots(_inc, _r)){
+            pool.push(worker++, path);
+        }
+
+        pool.run([&](std::size_t self, const boost::filesystem::path& dir){
+            _scan(pool, self, dir, batches[self]);
+        });
+
+        for (auto& batch : batches){
+            _keeper->add_files(batch);
         }
     }
 };
@@ -0,0 +1,517 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Интерфейс источника данных файла.
+ * Файл открывается один раз при первом чтении и остается открытым
+ * до вызова close() или до уничтожения источника
+*/
+class isource {
+public:
+    virtual ~isource() = default;
+    /**
+     * @brief Читает блок данных файла
+     * @arg offset Смещение блока от начала файла
+     * @arg size Размер блока
+     * @return Адрес прочитанных данных. Действителен до следующего вызова read() или close()
+    */
+    virtual const void* read(std::uint64_t offset, std::size_t size) = 0;
+    /**
+     * @brief Читает блок данных файла в буфер вызывающего
+     * @arg buffer Буфер не меньше size байт. Источник может не использовать его
+     * и вернуть адрес данных напрямую
+     * @return Адрес прочитанных данных. Действителен, пока жив буфер и не вызван close()
+    */
+    virtual const void* read_to(std::uint64_t offset, std::size_t size, char* buffer) = 0;
+    /**
+     * @brief Освобождает дескриптор и отображение файла.
+     * Повторное чтение после close() откроет файл заново
+    */
+    virtual void close() = 0;
+    /**
+     * @brief Дескриптор файла для асинхронного чтения в обход read()
+     * @return -1, если источник не читает файл через дескриптор
+    */
+    virtual int descriptor() {
+        return -1;
+    }
+    /**
+     * @brief Сообщает, что асинхронное чтение по descriptor() завершилось
+    */
+    virtual void settle() {}
+};
+
+/**
+ * @brief Обращение со страничным кэшем при чтении файлов
+*/
+enum class cache_policy {
+    /* Подсказки последовательного чтения и упреждающее чтение следующего блока */
+    sequential,
+    /* Прочитанные страницы сбрасываются из кэша */
+    dontneed,
+    /* Чтение в обход кэша (O_DIRECT) в выровненные буферы */
+    direct
+};
+
+/**
+ * @brief Политика страничного кэша из параметра cache_policy конфига
+*/
+inline cache_policy cache_policy_of_config(){
+    const std::string& policy = config::Config::instance().cache_policy;
+    if (policy == "dontneed") return cache_policy::dontneed;
+    if (policy == "direct")   return cache_policy::direct;
+    return cache_policy::sequential;
+}
+
+/**
+ * @brief Сбрасывает страницы файла из кэша
+*/
+inline void drop_cached_pages(const boost::filesystem::path& file){
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+/**
+ * @brief Дыры разреженного файла по SEEK_DATA/SEEK_HOLE.
+ * Файл, у которого занято не меньше блоков, чем его размер, не открывается
+ * @arg holes Куда сложить дыры [начало, конец) по возрастанию смещения
+ * @return false, если дыр нет или ФС не сообщает расположение данных
+*/
+template<typename Holes>
+inline bool find_holes(const boost::filesystem::path& file, std::uint64_t size, Holes& holes){
+    struct stat st;
+    if (::stat(file.c_str(), &st) != 0 || static_cast<std::uint64_t>(st.st_blocks) * 512 >= size) return false;
+
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    std::uint64_t pos = 0;
+    while (pos < size){
+        off_t data = ::lseek(fd, pos, SEEK_DATA);
+        if (data < 0){
+            /* ENXIO - дальше до конца файла данных нет, иначе ФС не поддерживает поиск */
+            if (errno == ENXIO) holes.emplace_back(pos, size);
+            else holes.clear();
+            break;
+        }
+        if (static_cast<std::uint64_t>(data) >= size){
+            holes.emplace_back(pos, size);
+            break;
+        }
+        if (static_cast<std::uint64_t>(data) > pos) holes.emplace_back(pos, data);
+
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0){
+            holes.clear();
+            break;
+        }
+        pos = hole;
+    }
+
+    ::close(fd);
+    return !holes.empty();
+}
+
+/**
+ * @brief Учет открытых дескрипторов файлов.
+ * Не дает источникам исчерпать лимит RLIMIT_NOFILE, когда
+ * в группе одновременно находятся тысячи файлов
+*/
+class fd_budget {
+private:
+    std::atomic<long> _used{0};
+    long _limit;
+
+    fd_budget() {
+        struct rlimit rl;
+        long limit = 1024;
+        if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY){
+            limit = static_cast<long>(rl.rlim_cur);
+        }
+        /* Оставить запас для stdio, сокетов asio и прочих нужд процесса */
+        _limit = std::max(16L, limit - 64);
+    }
+public:
+    fd_budget(const fd_budget&) = delete;
+
+    static fd_budget& instance(){
+        static fd_budget budget;
+        return budget;
+    }
+
+    /**
+     * @brief Занимает дескриптор из бюджета
+     * @return false, если бюджет исчерпан и дескриптор нужно закрыть сразу после чтения
+    */
+    bool acquire(){
+        if (_used.fetch_add(1, std::memory_order_relaxed) < _limit) return true;
+        _used.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void release(){
+        _used.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Всего дескрипторов в бюджете
+    */
+    long limit() const {
+        return _limit;
+    }
+};
+
+/**
+ * @brief Учет отображений файлов в память.
+ * Каждый mapped_region занимает запись из vm.max_map_count, и при ее
+ * исчерпании mmap падает с ENOMEM. Когда бюджет исчерпан, файлы читаются через pread
+*/
+class map_budget {
+private:
+    std::atomic<long> _used{0};
+    long _limit;
+
+    map_budget() {
+        long limit = 65530;
+        std::ifstream in("/proc/sys/vm/max_map_count");
+        in >> limit;
+        /* Оставить запас для библиотек, стеков потоков, malloc и io_uring */
+        _limit = std::max(64L, limit - std::max(1024L, limit / 8));
+    }
+public:
+    map_budget(const map_budget&) = delete;
+
+    static map_budget& instance(){
+        static map_budget budget;
+        return budget;
+    }
+
+    /**
+     * @brief Занимает отображение из бюджета
+     * @return false, если бюджет исчерпан и файл нужно читать без отображения
+    */
+    bool acquire(){
+        if (_used.fetch_add(1, std::memory_order_relaxed) < _limit) return true;
+        _used.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void release(){
+        _used.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief Источник, читающий файл через pread в буфер, общий для всех источников потока
+*/
+class pread_source : public isource {
+private:
+    /* Выравнивание смещений, длин и буферов чтения O_DIRECT */
+    static constexpr std::size_t _align = 4096;
+
+    const boost::filesystem::path& _file;
+    int _fd = -1;
+    /* Дескриптор учтен в fd_budget и может оставаться открытым между чтениями */
+    bool _owned = false;
+    cache_policy _policy;
+    /* Файл открыт с O_DIRECT. ФС без поддержки O_DIRECT читаются как при dontneed */
+    bool _direct = false;
+
+    static std::vector<char>& _buffer(){
+        thread_local std::vector<char> buffer;
+        return buffer;
+    }
+
+    /**
+     * @brief Выровненный буфер потока для чтения O_DIRECT
+    */
+    static char* _direct_buffer(std::size_t size){
+        thread_local std::unique_ptr<char, decltype(&std::free)> buffer{nullptr, &std::free};
+        thread_local std::size_t capacity = 0;
+        if (capacity < size){
+            buffer.reset(static_cast<char*>(std::aligned_alloc(_align, size)));
+            if (!buffer){
+                capacity = 0;
+                throw std::bad_alloc();
+            }
+            capacity = size;
+        }
+        return buffer.get();
+    }
+
+    void _open(){
+        _direct = false;
+        if (_policy == cache_policy::direct){
+            _fd = ::open(_file.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+            _direct = _fd >= 0;
+        }
+        if (_fd < 0) _fd = ::open(_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_fd < 0){
+            std::cerr << "Не удалось открыть файл " << _file << ": " << std::strerror(errno) << std::endl;
+            throw std::exception();
+        }
+        if (!_direct) ::posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        stats::local().opens.add();
+    }
+
+    void _pread(char* buffer, std::size_t size, std::uint64_t offset, std::size_t need){
+        std::size_t done = 0;
+        while (done < need){
+            ssize_t n = ::pread(_fd, buffer + done, size - done, offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0){
+                std::cerr << "Ошибка чтения файла " << _file << std::endl;
+                close();
+                throw std::exception();
+            }
+            done += static_cast<std::size_t>(n);
+        }
+    }
+
+    /**
+     * @brief Чтение O_DIRECT: блок расширяется до границ выравнивания
+     * и читается в выровненный буфер потока
+     * @arg out Куда скопировать данные, nullptr - вернуть адрес в буфере потока
+    */
+    const void* _read_direct(std::uint64_t offset, std::size_t size, char* out){
+        std::uint64_t start = offset & ~static_cast<std::uint64_t>(_align - 1);
+        std::uint64_t end   = (offset + size + _align - 1) & ~static_cast<std::uint64_t>(_align - 1);
+        char* aligned = _direct_buffer(end - start);
+
+        /* Конец файла может быть не выровнен - короткое последнее чтение допустимо */
+        _pread(aligned, end - start, start, offset + size - start);
+
+        const char* data = aligned + (offset - start);
+        if (out == nullptr) return data;
+        std::memcpy(out, data, size);
+        return out;
+    }
+
+    /**
+     * @brief Читает блок открытого файла и дает подсказку кэшу по политике
+    */
+    const void* _read_to(std::uint64_t offset, std::size_t size, char* buffer){
+        const void* data;
+        if (_direct){
+            data = _read_direct(offset, size, buffer);
+        } else {
+            _pread(buffer, size, offset, size);
+            data = buffer;
+
+            if (_policy == cache_policy::sequential){
+                /* Следующий блок подгружается, пока хэшируется текущий */
+                ::posix_fadvise(_fd, offset + size, size, POSIX_FADV_WILLNEED);
+            } else {
+                ::posix_fadvise(_fd, offset, size, POSIX_FADV_DONTNEED);
+            }
+        }
+
+        stat_counters& counters = stats::local();
+        counters.reads.add();
+        counters.bytes_read.add(size);
+
+        /* Бюджет исчерпан - не держать дескриптор между блоками */
+        if (!_owned) close();
+
+        return data;
+    }
+
+public:
+    explicit pread_source(const boost::filesystem::path& file, cache_policy policy = cache_policy::sequential) :
+        _file(file), _policy(policy)
+    {}
+    ~pread_source() {
+        close();
+    }
+
+    const void* read(std::uint64_t offset, std::size_t size) override {
+        if (_fd < 0){
+            _open();
+            _owned = fd_budget::instance().acquire();
+        }
+        if (_direct) return _read_to(offset, size, nullptr);
+
+        std::vector<char>& buffer = _buffer();
+        if (buffer.size() < size) buffer.resize(size);
+
+        return _read_to(offset, size, buffer.data());
+    }
+
+    const void* read_to(std::uint64_t offset, std::size_t size, char* buffer) override {
+        if (_fd < 0){
+            _open();
+            _owned = fd_budget::instance().acquire();
+        }
+        return _read_to(offset, size, buffer);
+    }
+
+    /**
+     * @brief Дескриптор для io_uring. При O_DIRECT блоки не выровнены,
+     * поэтому асинхронное чтение не используется
+    */
+    int descriptor() override {
+        if (_policy == cache_policy::direct) return -1;
+        if (_fd < 0){
+            _open();
+            _owned = fd_budget::instance().acquire();
+        }
+        return _fd;
+    }
+
+    void settle() override {
+        if (!_owned) close();
+    }
+
+    void close() override {
+        if (_fd < 0) return;
+        /* Страницы, прочитанные через io_uring в обход read_to */
+        if (_policy == cache_policy::dontneed) ::posix_fadvise(_fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(_fd);
+        _fd = -1;
+        if (_owned) fd_budget::instance().release();
+        _owned = false;
+    }
+};
+
+/**
+ * @brief Источник, отображающий весь файл в память одним mapped_region.
+ * Дескриптор закрывается сразу после создания отображения,
+ * поэтому лимит открытых файлов не расходуется.
+ * Если бюджет отображений исчерпан или отобразить файл не удалось, файл читается через pread
+*/
+class mmap_source : public isource {
+private:
+    const boost::filesystem::path& _file;
+    std::unique_ptr<boost::interprocess::mapped_region> _region;
+    cache_policy _policy;
+    /* Чтение без отображения */
+    std::unique_ptr<pread_source> _fallback;
+
+    void _map(){
+        if (!map_budget::instance().acquire()){
+            _fallback = std::make_unique<pread_source>(_file, _policy);
+            return;
+        }
+
+        try {
+            boost::interprocess::file_mapping mapping(_file.string().c_str(), boost::interprocess::read_only);
+            _region = std::make_unique<boost::interprocess::mapped_region>(
+                mapping, boost::interprocess::read_only
+            );
+        } catch(const boost::interprocess::interprocess_exception& e) {
+            map_budget::instance().release();
+            std::cerr << "Не удалось отобразить файл " << _file << ": " << e.what()
+                << ", файл читается через pread" << std::endl;
+            _fallback = std::make_unique<pread_source>(_file, _policy);
+            return;
+        }
+
+        _region->advise(boost::interprocess::mapped_region::advice_sequential);
+        stats::local().maps.add();
+    }
+public:
+    explicit mmap_source(const boost::filesystem::path& file, cache_policy policy = cache_policy::sequential) :
+        _file(file), _policy(policy)
+    {}
+    ~mmap_source() {
+        close();
+    }
+
+    const void* read(std::uint64_t offset, std::size_t size) override {
+        if (!_region && !_fallback) _map();
+        if (_fallback) return _fallback->read(offset, size);
+
+        if (offset + size > _region->get_size()){
+            std::cerr << "Файл " << _file << " изменился во время чтения" << std::endl;
+            throw std::exception();
+        }
+
+        stat_counters& counters = stats::local();
+        counters.reads.add();
+        counters.bytes_read.add(size);
+        return static_cast<const char*>(_region->get_address()) + offset;
+    }
+
+    const void* read_to(std::uint64_t offset, std::size_t size, char* buffer) override {
+        if (!_region && !_fallback) _map();
+        if (_fallback) return _fallback->read_to(offset, size, buffer);
+        return read(offset, size);
+    }
+
+    /**
+     * @brief Снимает отображение. При политике dontneed страницы файла,
+     * больше не отображенные в память, сбрасываются из кэша.
+     * Следующее чтение снова попробует отобразить файл
+    */
+    void close() override {
+        _fallback.reset();
+        if (!_region) return;
+        _region.reset();
+        map_budget::instance().release();
+        if (_policy == cache_policy::dontneed) drop_cached_pages(_file);
+    }
+};
+
+/**
+ * @brief Создает источник данных в соответствии с параметром reader конфига
+ * @arg file Путь к файлу. Должен жить дольше источника
+*/
+inline std::unique_ptr<isource> make_source(const boost::filesystem::path& file){
+    cache_policy policy = cache_policy_of_config();
+    if (config::Config::instance().reader != "mmap" || policy == cache_policy::direct){
+        return std::make_unique<pread_source>(file, policy);
+    }
+    return std::make_unique<mmap_source>(file, policy);
+}
+
+/**
+ * @brief Создает источник данных в арене группы
+ * @arg file Путь к файлу. Должен жить дольше источника
+ * @arg mmap Читать отображением файла, иначе - через pread
+ * @arg policy Обращение со страничным кэшем
+*/
+inline arena_ptr<isource> make_source(const boost::filesystem::path& file, group_arena& arena, bool mmap,
+    cache_policy policy)
+{
+    if (mmap && policy != cache_policy::direct){
+        return arena.make<mmap_source>(file, policy);
+    }
+    return arena.make<pread_source>(file, policy);
+}
+
+/**
+ * @brief Стоит ли выбирать подпись файлов этого размера.
+ * Если выборки покрывают заметную часть файла, проще сразу сравнить его целиком
+*/
+inline bool signature_worthwhile(std::uint64_t size){
+    const auto& conf = config::Config::instance();
+    std::uint64_t sampled = conf.sample * (2 + conf.samples);
+    return conf.sample > 0 && size > 4 * sampled;
+}
+
+/**
+ * @brief Подпись файла: CRC32C от выборок начала, конца и равномерно
+ * расположенных выборок середины файла (размер и кол-во - из конфига)
+ * @arg source Источник данных файла
+ * @arg size Размер файла
+*/
+inline digest_t sample_signature(isource& source, std::uint64_t size){
+    const auto& conf = config::Config::instance();
+    std::size_t len = std::min<std::uint64_t>(conf.sample, size);
+
+    crc32c_hasher h;
+    auto take = [&](std::uint64_t offset){
+        h.next_hash(source.read(offset, len), len);
+    };
+
+    take(0);
+    for (std::size_t i = 1; i <= conf.samples; i++){
+        take((size - len) * i / (conf.samples + 1));
+    }
+    take(size - len);
+
+    return h.checksum();
+}
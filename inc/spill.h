@@ -0,0 +1,351 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Хранилище файлов с ограниченной памятью.
+ * Файлы копятся в памяти, пока их объем не достигнет лимита, затем
+ * буфер сортируется по размеру и сбрасывается на диск отдельным прогоном.
+ * Группировка - k-путевое слияние прогонов по размеру, группы читаются
+ * с диска потоком, и в памяти одновременно находится только текущая группа
+*/
+class SpillKeeper : public IKeeper {
+private:
+    struct entry {
+        std::uint64_t size;
+        std::uint64_t dev;
+        std::uint64_t ino;
+        std::string path;
+    };
+
+    /**
+     * @brief Последовательное чтение записей одного прогона
+    */
+    class run_reader {
+    private:
+        /* Буфер объявлен раньше потока, чтобы пережить его */
+        std::unique_ptr<char[]> _buffer;
+        std::ifstream _in;
+        /* Дескриптор учтен в fd_budget */
+        bool _owned;
+    public:
+        run_reader(const boost::filesystem::path& path, std::size_t buffer_size) :
+            _buffer(new char[buffer_size]), _owned(fd_budget::instance().acquire())
+        {
+            _in.rdbuf()->pubsetbuf(_buffer.get(), buffer_size);
+            _in.open(path.string(), std::ios::binary);
+            if (!_in){
+                if (_owned) fd_budget::instance().release();
+                std::cerr << "Не удалось открыть временный файл " << path << ": " << std::strerror(errno) << std::endl;
+                throw std::exception();
+            }
+        }
+
+        ~run_reader() {
+            if (_owned) fd_budget::instance().release();
+        }
+
+        run_reader(const run_reader&) = delete;
+
+        bool next(entry& e){
+            std::uint32_t len;
+            if (!_in.read(reinterpret_cast<char*>(&e.size), sizeof(e.size))) return false;
+            _in.read(reinterpret_cast<char*>(&e.dev), sizeof(e.dev));
+            _in.read(reinterpret_cast<char*>(&e.ino), sizeof(e.ino));
+            _in.read(reinterpret_cast<char*>(&len), sizeof(len));
+            e.path.resize(len);
+            _in.read(e.path.data(), len);
+            return static_cast<bool>(_in);
+        }
+    };
+
+    /**
+     * @brief Последовательная запись прогона
+    */
+    class run_writer {
+    private:
+        boost::filesystem::path _path;
+        std::unique_ptr<char[]> _buffer;
+        std::ofstream _out;
+        std::uint64_t _bytes = 0;
+    public:
+        run_writer(const boost::filesystem::path& path, std::size_t buffer_size) :
+            _path(path), _buffer(new char[buffer_size])
+        {
+            _out.rdbuf()->pubsetbuf(_buffer.get(), buffer_size);
+            _out.open(path.string(), std::ios::binary | std::ios::trunc);
+        }
+
+        void write(const entry& e){
+            std::uint32_t len = static_cast<std::uint32_t>(e.path.size());
+            _out.write(reinterpret_cast<const char*>(&e.size), sizeof(e.size));
+            _out.write(reinterpret_cast<const char*>(&e.dev), sizeof(e.dev));
+            _out.write(reinterpret_cast<const char*>(&e.ino), sizeof(e.ino));
+            _out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            _out.write(e.path.data(), len);
+            _bytes += sizeof(e.size) + sizeof(e.dev) + sizeof(e.ino) + sizeof(len) + len;
+        }
+
+        /**
+         * @brief Закрывает прогон
+         * @return Путь прогона
+        */
+        boost::filesystem::path close(){
+            _out.close();
+            if (!_out){
+                std::cerr << "Не удалось записать временный файл " << _path << std::endl;
+                throw std::exception();
+            }
+
+            stat_counters& counters = stats::local();
+            counters.spill_runs.add();
+            counters.spill_bytes.add(_bytes);
+            return _path;
+        }
+    };
+
+    /* Буфер чтения одного прогона при слиянии */
+    static constexpr std::size_t _read_buffer = 1 << 20;
+    /* Наименьший буфер чтения прогона */
+    static constexpr std::size_t _min_buffer = 4096;
+
+    /* Лимит памяти под файлы в буфере, байт */
+    std::size_t _limit;
+    /* Память под строки путей в буфере */
+    std::size_t _used = 0;
+    std::vector<entry> _buffer;
+
+    /* Директория прогонов, создается при первом сбросе */
+    boost::filesystem::path _dir;
+    std::vector<boost::filesystem::path> _runs;
+    /* Кол-во созданных прогонов, включая промежуточные */
+    std::size_t _created = 0;
+    std::mutex _mutex;
+
+    void _add(std::string path, std::uint64_t size, std::uint64_t dev = 0, std::uint64_t ino = 0){
+        _buffer.push_back(entry{size, dev, ino, std::move(path)});
+        /* Короткие строки хранятся внутри entry и отдельной памяти не занимают */
+        if (_buffer.back().path.capacity() > 15) _used += _buffer.back().path.capacity() + 1;
+        if (_used + _buffer.capacity() * sizeof(entry) >= _limit) _spill();
+    }
+
+    /**
+     * @brief Путь нового прогона. Директория прогонов создается при первом обращении
+    */
+    boost::filesystem::path _next_run(){
+        if (_dir.empty()){
+            _dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("babayan-spill-%%%%-%%%%");
+            boost::filesystem::create_directories(_dir);
+        }
+        return _dir / ("run" + std::to_string(_created++));
+    }
+
+    /**
+     * @brief Сортирует буфер по размеру и сбрасывает его на диск
+    */
+    void _spill(){
+        if (_buffer.empty()) return;
+
+        std::stable_sort(_buffer.begin(), _buffer.end(), [](const entry& a, const entry& b){
+            return a.size < b.size;
+        });
+
+        run_writer out(_next_run(), _read_buffer);
+        for (const auto& e : _buffer) out.write(e);
+        _runs.push_back(out.close());
+
+        std::vector<entry>().swap(_buffer);
+        _used = 0;
+    }
+
+    /**
+     * @brief Сколько прогонов сливается за раз: буферы всех открытых прогонов
+     * вместе не выходят за лимит памяти, а их дескрипторы занимают
+     * не больше половины fd_budget - остальное нужно Reader
+    */
+    std::size_t _fan_in() const {
+        std::size_t by_memory = _limit / _min_buffer;
+        std::size_t by_fds    = static_cast<std::size_t>(fd_budget::instance().limit()) / 2;
+        /* Один дескриптор - под выходной прогон промежуточного слияния */
+        return std::max<std::size_t>(std::min(by_memory, by_fds), 3) - 1;
+    }
+
+    /**
+     * @brief k-путевое слияние источников по размеру.
+     * При равных размерах раньше идет запись более раннего источника
+     * @arg sources Источники, вызываются как source(entry&), false - записи кончились
+     * @arg emit Получатель записей по возрастанию размера
+    */
+    template<typename Emit>
+    static void _merge(std::vector<std::function<bool(entry&)>>& sources, Emit&& emit){
+        std::vector<entry> heads(sources.size());
+        auto greater = [&](std::size_t a, std::size_t b){
+            return std::tie(heads[a].size, a) > std::tie(heads[b].size, b);
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(greater);
+        for (std::size_t i = 0; i < sources.size(); i++){
+            if (sources[i](heads[i])) heap.push(i);
+        }
+
+        while (!heap.empty()){
+            std::size_t i = heap.top();
+            heap.pop();
+            emit(heads[i]);
+            if (sources[i](heads[i])) heap.push(i);
+        }
+    }
+
+    /**
+     * @brief Сливает соседние прогоны по _fan_in() штук в промежуточные,
+     * пока все прогоны нельзя открыть одновременно. Порядок прогонов сохраняется
+    */
+    void _reduce_runs(){
+        const std::size_t fan_in = _fan_in();
+        while (_runs.size() > fan_in){
+            /* Буфер записи считается еще одним прогоном */
+            const std::size_t buffer_size = std::clamp<std::size_t>(_limit / (fan_in + 1), _min_buffer, _read_buffer);
+            std::vector<boost::filesystem::path> merged;
+
+            for (std::size_t start = 0; start < _runs.size(); start += fan_in){
+                std::size_t end = std::min(start + fan_in, _runs.size());
+                if (end - start == 1){
+                    merged.push_back(_runs[start]);
+                    continue;
+                }
+
+                std::vector<std::unique_ptr<run_reader>> readers;
+                std::vector<std::function<bool(entry&)>> sources;
+                for (std::size_t i = start; i < end; i++){
+                    readers.push_back(std::make_unique<run_reader>(_runs[i], buffer_size));
+                    sources.push_back([r = readers.back().get()](entry& e){ return r->next(e); });
+                }
+
+                run_writer out(_next_run(), buffer_size);
+                _merge(sources, [&](entry& e){ out.write(e); });
+                readers.clear();
+                merged.push_back(out.close());
+                for (std::size_t i = start; i < end; i++) boost::filesystem::remove(_runs[i]);
+            }
+            _runs = std::move(merged);
+        }
+    }
+
+    /**
+     * @brief Отбрасывает повторы одного пути, сохраняя первое вхождение
+    */
+    static void _unique(std::vector<file_entry>& files){
+        if (files.size() < 2) return;
+
+        std::vector<std::size_t> order(files.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){
+            return files[a].path.native() < files[b].path.native();
+        });
+
+        std::vector<bool> drop(files.size(), false);
+        for (std::size_t i = 1; i < order.size(); i++){
+            if (files[order[i]].path == files[order[i - 1]].path) drop[order[i]] = true;
+        }
+
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < files.size(); i++){
+            if (drop[i]) continue;
+            if (out != i) files[out] = std::move(files[i]);
+            out++;
+        }
+        files.erase(files.begin() + out, files.end());
+    }
+
+public:
+    /**
+     * @arg limit Лимит памяти под буфер файлов, байт
+    */
+    explicit SpillKeeper(std::size_t limit) : _limit(std::max<std::size_t>(limit, 1)) {}
+
+    ~SpillKeeper() {
+        if (_dir.empty()) return;
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(_dir, ec);
+    }
+
+    void add_file(boost::filesystem::path file, std::uint64_t size) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _add(file.string(), size);
+    }
+
+    void add_files(const std::vector<file_entry>& files) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const auto& f : files){
+            _add(f.path.string(), f.size, f.dev, f.ino);
+        }
+    }
+
+    /**
+     * @brief Сливает прогоны по размеру. Если на диск ничего не сбрасывалось,
+     * группы выдаются прямо из отсортированного буфера
+    */
+    coro_pull_t group_by_size(std::size_t min_files = 1) override {
+        coro_pull_t coro([&, min_files](coro_push_t& yield){
+            /* Источник записей: прогон на диске или буфер в памяти */
+            std::vector<std::function<bool(entry&)>> sources;
+            std::vector<std::unique_ptr<run_reader>> readers;
+            std::size_t position = 0;
+
+            if (_runs.empty()){
+                std::stable_sort(_buffer.begin(), _buffer.end(), [](const entry& a, const entry& b){
+                    return a.size < b.size;
+                });
+                sources.push_back([&](entry& e){
+                    if (position == _buffer.size()) return false;
+                    e = _buffer[position++];
+                    return true;
+                });
+            } else {
+                _spill();
+                _reduce_runs();
+                /* Буферы всех прогонов вместе не выходят за лимит */
+                std::size_t buffer_size = std::clamp<std::size_t>(_limit / _runs.size(), _min_buffer, _read_buffer);
+                for (const auto& run : _runs){
+                    readers.push_back(std::make_unique<run_reader>(run, buffer_size));
+                    sources.push_back([r = readers.back().get()](entry& e){ return r->next(e); });
+                }
+            }
+
+            std::shared_ptr<std::vector<file_entry>> files;
+            std::uint64_t size = 0;
+            auto flush = [&](){
+                if (!files) return;
+                _unique(*files);
+                std::size_t count = files->size();
+                if (count < min_files) files.reset();
+                yield(file_group(size, count, std::move(files)));
+                files.reset();
+            };
+
+            _merge(sources, [&](entry& e){
+                if (files && e.size != size) flush();
+                if (!files){
+                    files = std::make_shared<std::vector<file_entry>>();
+                    size  = e.size;
+                }
+                files->emplace_back(std::move(e.path), e.size, e.dev, e.ino);
+            });
+            flush();
+        });
+        return coro;
+    }
+};
+
+/**
+ * @brief Создает хранилище файлов в соответствии с параметрами store и memory_limit конфига
+*/
+inline std::shared_ptr<IKeeper> make_keeper(){
+    const auto& conf = config::Config::instance();
+    if (conf.memory_limit > 0){
+        return std::make_shared<SpillKeeper>((conf.memory_limit << 20) / 2);
+    }
+    if (conf.store == "index"){
+        return std::make_shared<Keeper>();
+    }
+    return std::make_shared<FlatKeeper>();
+}
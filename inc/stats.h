@@ -0,0 +1,329 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Счетчик, который пишет только один поток-владелец.
+ * Обновление - обычные load/store без атомарных RMW-операций,
+ * читать его можно из любого потока
+*/
+struct stat_counter {
+    std::atomic<std::uint64_t> value{0};
+
+    void add(std::uint64_t n = 1){
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief Счетчики одного потока
+*/
+struct stat_counters {
+    /* Глубина блоков, до которой ведется учет отсеянных файлов */
+    static constexpr std::size_t depths = 64;
+
+    /* Сканирование */
+    stat_counter dirs;
+    stat_counter entries;
+    stat_counter stat_calls;
+    stat_counter filtered_size;
+    stat_counter filtered_mask;
+    stat_counter files_added;
+
+    /* Чтение */
+    stat_counter opens;
+    stat_counter maps;
+    stat_counter reads;
+    stat_counter bytes_read;
+    stat_counter spill_runs;
+    stat_counter spill_bytes;
+
+    /* Хэширование и сравнение */
+    stat_counter blocks_hashed;
+    stat_counter bytes_hashed;
+    stat_counter bytes_compared;
+    stat_counter cache_hits;
+    stat_counter cache_partial;
+    stat_counter failed;
+    /* Пути к уже отобранному inode, которые не читались */
+    stat_counter hardlinks;
+    /* Разреженные файлы и байты их дыр, хэшированные как нули без чтения */
+    stat_counter sparse_files;
+    stat_counter bytes_holes;
+    /* Байты кандидатов, которые больше не нужно читать: прочитанные или отсеянные */
+    stat_counter bytes_done;
+
+    /* Конвейер: подписи, вычисленные во время сканирования, и подгруженные файлы */
+    stat_counter speculated;
+    stat_counter prefetched;
+
+    /* Отсеянные файлы: по подписи, при побайтном сравнении и по глубине блока */
+    stat_counter eliminated_sample;
+    stat_counter eliminated_bytes;
+    stat_counter eliminated_depth[depths];
+
+    /* Результат */
+    stat_counter duplicate_groups;
+    stat_counter duplicate_files;
+};
+
+/**
+ * @brief Синглтон статистики запуска.
+ * Каждый поток пишет в свои stat_counters, суммирование - только при отчете
+*/
+class stats {
+public:
+    /* Время фазы: настенное и процессорное, нс */
+    struct phase_time {
+        std::uint64_t wall = 0;
+        std::uint64_t cpu  = 0;
+    };
+
+    /* Кол-во корзин распределения размеров групп: 2^i .. 2^(i+1)-1 файлов */
+    static constexpr std::size_t group_buckets = 32;
+
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<stat_counters>> _threads;
+    std::map<std::string, phase_time> _phases;
+
+    stats() = default;
+public:
+    /* Заполняются одним потоком, перебирающим группы */
+    std::uint64_t size_groups = 0;
+    std::uint64_t candidate_groups = 0;
+    std::uint64_t candidate_files = 0;
+    std::uint64_t group_sizes[group_buckets] = {};
+    /* Байты всех файлов в группах из двух и более файлов */
+    std::atomic<std::uint64_t> candidate_bytes{0};
+
+    stats(const stats&) = delete;
+
+    static stats& instance(){
+        static stats s;
+        return s;
+    }
+
+    /**
+     * @brief Счетчики текущего потока. Живут до конца программы,
+     * поэтому переживают потоки пулов
+    */
+    static stat_counters& local(){
+        thread_local stat_counters* counters = nullptr;
+        if (counters == nullptr){
+            auto& s = instance();
+            std::lock_guard<std::mutex> lock(s._mutex);
+            s._threads.push_back(std::make_unique<stat_counters>());
+            counters = s._threads.back().get();
+        }
+        return *counters;
+    }
+
+    /**
+     * @brief Сумма счетчика по всем потокам
+    */
+    std::uint64_t total(stat_counter stat_counters::* field){
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::uint64_t sum = 0;
+        for (auto& t : _threads) sum += ((*t).*field).get();
+        return sum;
+    }
+
+    std::uint64_t total_eliminated(std::size_t depth){
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::uint64_t sum = 0;
+        for (auto& t : _threads) sum += t->eliminated_depth[depth].get();
+        return sum;
+    }
+
+    /**
+     * @brief Учитывает группу файлов одного размера
+    */
+    void add_group(std::size_t files, std::uint64_t size){
+        size_groups++;
+        group_sizes[std::min<std::size_t>(std::bit_width(files) - 1, group_buckets - 1)]++;
+        if (files > 1){
+            candidate_groups++;
+            candidate_files += files;
+            candidate_bytes.fetch_add(files * size, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Добавляет время к фазе. Потокобезопасно
+    */
+    void add_phase(const std::string& name, std::uint64_t wall, std::uint64_t cpu){
+        std::lock_guard<std::mutex> lock(_mutex);
+        _phases[name].wall += wall;
+        _phases[name].cpu  += cpu;
+    }
+
+    /**
+     * @brief Отчет в формате JSON
+    */
+    void write_json(std::ostream& out){
+        auto ms = [](std::uint64_t ns){ return ns / 1e6; };
+        auto field = [&](const char* name, stat_counter stat_counters::* f, bool last = false){
+            out << "    \"" << name << "\": " << total(f) << (last ? "\n" : ",\n");
+        };
+
+        out << "{\n  \"scan\": {\n";
+        field("dirs", &stat_counters::dirs);
+        field("entries", &stat_counters::entries);
+        field("stat_calls", &stat_counters::stat_calls);
+        field("filtered_size", &stat_counters::filtered_size);
+        field("filtered_mask", &stat_counters::filtered_mask);
+        field("files", &stat_counters::files_added, true);
+
+        out << "  },\n  \"groups\": {\n"
+            << "    \"size_groups\": " << size_groups << ",\n"
+            << "    \"candidate_groups\": " << candidate_groups << ",\n"
+            << "    \"candidate_files\": " << candidate_files << ",\n"
+            << "    \"candidate_bytes\": " << candidate_bytes.load() << ",\n"
+            << "    \"size_distribution\": {";
+        bool first = true;
+        for (std::size_t i = 0; i < group_buckets; i++){
+            if (group_sizes[i] == 0) continue;
+            out << (first ? "" : ", ") << '"' << (1ULL << i) << '"' << ": " << group_sizes[i];
+            first = false;
+        }
+        out << "}\n  },\n  \"io\": {\n";
+        field("opens", &stat_counters::opens);
+        field("maps", &stat_counters::maps);
+        field("reads", &stat_counters::reads);
+        field("bytes_read", &stat_counters::bytes_read);
+        field("spill_runs", &stat_counters::spill_runs);
+        field("spill_bytes", &stat_counters::spill_bytes, true);
+
+        std::uint64_t hashed = total(&stat_counters::bytes_hashed);
+        double hash_sec = _phases["search"].wall / 1e9;
+        out << "  },\n  \"hash\": {\n";
+        field("blocks", &stat_counters::blocks_hashed);
+        field("bytes", &stat_counters::bytes_hashed);
+        field("bytes_compared", &stat_counters::bytes_compared);
+        field("cache_hits", &stat_counters::cache_hits);
+        field("cache_partial", &stat_counters::cache_partial);
+        field("failed", &stat_counters::failed);
+        field("hardlinks", &stat_counters::hardlinks);
+        field("sparse_files", &stat_counters::sparse_files);
+        field("bytes_holes", &stat_counters::bytes_holes);
+        out << "    \"mb_per_s\": " << (hash_sec > 0 ? hashed / hash_sec / 1e6 : 0) << ",\n"
+            << "    \"eliminated\": {\n";
+        out << "      \"sample\": " << total(&stat_counters::eliminated_sample) << ",\n"
+            << "      \"bytes\": " << total(&stat_counters::eliminated_bytes) << ",\n"
+            << "      \"by_depth\": [";
+        std::size_t last = 0;
+        for (std::size_t d = 0; d < stat_counters::depths; d++){
+            if (total_eliminated(d)) last = d + 1;
+        }
+        for (std::size_t d = 0; d < last; d++){
+            out << (d ? ", " : "") << total_eliminated(d);
+        }
+        out << "]\n    }\n  },\n  \"pipeline\": {\n";
+        field("speculated", &stat_counters::speculated);
+        field("prefetched", &stat_counters::prefetched, true);
+
+        out << "  },\n  \"result\": {\n";
+        field("duplicate_groups", &stat_counters::duplicate_groups);
+        field("duplicate_files", &stat_counters::duplicate_files, true);
+
+        out << "  },\n  \"phases\": {";
+        first = true;
+        for (auto& [name, t] : _phases){
+            out << (first ? "\n" : ",\n") << "    \"" << name << "\": {\"wall_ms\": " << ms(t.wall)
+                << ", \"cpu_ms\": " << ms(t.cpu) << "}";
+            first = false;
+        }
+        out << "\n  }\n}" << std::endl;
+    }
+};
+
+/**
+ * @brief Замер времени фазы на время жизни объекта.
+ * Процессорное время - всего процесса за этот интервал, у всех фаз одно и то же:
+ * scan и search идут друг за другом, а group и output вложены в search
+ * и считают также хэширование, идущее в это время в других потоках
+*/
+class phase_timer {
+private:
+    std::string _name;
+    std::chrono::steady_clock::time_point _wall;
+    std::uint64_t _cpu;
+
+    static std::uint64_t _cpu_now(){
+        struct timespec ts;
+        ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+public:
+    phase_timer(std::string name) :
+        _name(std::move(name)),
+        _wall(std::chrono::steady_clock::now()), _cpu(_cpu_now())
+    {}
+
+    ~phase_timer() {
+        auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _wall
+        ).count();
+        stats::instance().add_phase(_name, wall, _cpu_now() - _cpu);
+    }
+
+    phase_timer(const phase_timer&) = delete;
+};
+
+/**
+ * @brief Периодическая строка прогресса в stderr с оценкой оставшегося времени
+*/
+class progress {
+private:
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop = false;
+
+    static void _print(double elapsed){
+        auto& s = stats::instance();
+        double total = s.candidate_bytes.load(std::memory_order_relaxed);
+        double done  = std::min<double>(s.total(&stat_counters::bytes_done), total);
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1)
+            << "progress: " << done / (1 << 20) << " / " << total / (1 << 20) << " MiB";
+        if (total > 0) line << " (" << 100 * done / total << "%)";
+        if (done > 0 && total > done) line << ", ETA " << elapsed * (total - done) / done << " s";
+
+        std::cerr << line.str() << std::endl;
+    }
+public:
+    /**
+     * @brief Запускает поток вывода прогресса
+     * @arg interval Период вывода, секунды. 0 - прогресс не выводится
+    */
+    explicit progress(std::size_t interval) {
+        if (interval == 0) return;
+
+        _thread = std::thread([this, interval](){
+            auto start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_cv.wait_for(lock, std::chrono::seconds(interval), [this]{ return _stop; })){
+                _print(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+        });
+    }
+
+    ~progress() {
+        if (!_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_one();
+        _thread.join();
+    }
+
+    progress(const progress&) = delete;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Кольцо io_uring для асинхронного чтения блоков файлов.
+ * Работает через системные вызовы напрямую, без liburing.
+ * Каждому слоту очереди соответствует свой буфер, буферы по возможности
+ * регистрируются в ядре (IORING_OP_READ_FIXED)
+*/
+class uring {
+private:
+    int _fd = -1;
+
+    void*       _sq_ptr = MAP_FAILED;
+    std::size_t _sq_len = 0;
+    void*       _cq_ptr = MAP_FAILED;
+    std::size_t _cq_len = 0;
+    io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t   _sqes_len = 0;
+
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    io_uring_cqe* _cqes;
+
+    /* Кол-во слотов (и буферов) */
+    unsigned _depth;
+    /* Размер буфера слота */
+    std::size_t _buffer_size;
+    std::unique_ptr<char, decltype(&std::free)> _buffers{nullptr, &std::free};
+    /* Буферы зарегистрированы в ядре */
+    bool _fixed = false;
+    /* Свободные слоты */
+    std::vector<unsigned> _free;
+    /* Подготовлено, но еще не отправлено в ядро */
+    unsigned _unsubmitted = 0;
+
+    static int _setup(unsigned entries, io_uring_params* p){
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+    }
+
+    static int _enter(int fd, unsigned submit, unsigned wait, unsigned flags){
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+    }
+
+    static int _register(int fd, unsigned opcode, const void* arg, unsigned n){
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, n));
+    }
+
+    void _cleanup(){
+        if (_sqes != MAP_FAILED) ::munmap(_sqes, _sqes_len);
+        if (_cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr) ::munmap(_cq_ptr, _cq_len);
+        if (_sq_ptr != MAP_FAILED) ::munmap(_sq_ptr, _sq_len);
+        _sqes   = static_cast<io_uring_sqe*>(MAP_FAILED);
+        _cq_ptr = _sq_ptr = MAP_FAILED;
+        if (_fd >= 0) ::close(_fd);
+        _fd = -1;
+    }
+
+    template<typename T>
+    T* _at(void* base, unsigned offset){
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+public:
+    /**
+     * @brief Создает кольцо. При ошибке бросает std::system_error
+     * @arg depth Кол-во одновременных чтений
+     * @arg buffer_size Размер буфера одного чтения
+    */
+    uring(unsigned depth, std::size_t buffer_size) : _depth(depth), _buffer_size(buffer_size) {
+        io_uring_params p{};
+        _fd = _setup(depth, &p);
+        if (_fd < 0) throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        _sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) _sq_len = _cq_len = std::max(_sq_len, _cq_len);
+
+        _sq_ptr = ::mmap(nullptr, _sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sq_ptr == MAP_FAILED){
+            int err = errno;
+            _cleanup();
+            throw std::system_error(err, std::generic_category(), "io_uring sq mmap");
+        }
+        _cq_ptr = single ? _sq_ptr :
+            ::mmap(nullptr, _cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        _sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(
+            ::mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES)
+        );
+        if (_cq_ptr == MAP_FAILED || _sqes == MAP_FAILED){
+            int err = errno;
+            _cleanup();
+            throw std::system_error(err, std::generic_category(), "io_uring mmap");
+        }
+
+        _sq_tail  = _at<unsigned>(_sq_ptr, p.sq_off.tail);
+        _sq_mask  = _at<unsigned>(_sq_ptr, p.sq_off.ring_mask);
+        _sq_array = _at<unsigned>(_sq_ptr, p.sq_off.array);
+        _cq_head  = _at<unsigned>(_cq_ptr, p.cq_off.head);
+        _cq_tail  = _at<unsigned>(_cq_ptr, p.cq_off.tail);
+        _cq_mask  = _at<unsigned>(_cq_ptr, p.cq_off.ring_mask);
+        _cqes     = _at<io_uring_cqe>(_cq_ptr, p.cq_off.cqes);
+
+        _depth = std::min(_depth, p.sq_entries);
+        _buffers.reset(static_cast<char*>(std::aligned_alloc(4096, _depth * _buffer_size)));
+        if (!_buffers){
+            _cleanup();
+            throw std::bad_alloc();
+        }
+
+        /* Без регистрации (например, из-за RLIMIT_MEMLOCK) работает обычный IORING_OP_READ */
+        std::vector<iovec> iov(_depth);
+        for (unsigned i = 0; i < _depth; i++){
+            iov[i].iov_base = buffer(i);
+            iov[i].iov_len  = _buffer_size;
+        }
+        _fixed = _register(_fd, IORING_REGISTER_BUFFERS, iov.data(), _depth) == 0;
+
+        for (unsigned i = _depth; i > 0; i--){
+            _free.push_back(i - 1);
+        }
+    }
+
+    ~uring() {
+        _cleanup();
+    }
+
+    uring(const uring&) = delete;
+
+    /**
+     * @brief Кольцо текущего потока. Создается при первом обращении
+     * и пересоздается, если нужны буферы большего размера
+     * @return nullptr, если io_uring недоступен (старое ядро, seccomp и т.п.)
+    */
+    static uring* local(unsigned depth, std::size_t buffer_size){
+        static std::atomic<bool> unavailable{false};
+        thread_local std::unique_ptr<uring> ring;
+
+        if (unavailable.load(std::memory_order_relaxed)) return nullptr;
+        if (ring && ring->_buffer_size >= buffer_size) return ring.get();
+
+        try {
+            ring.reset();
+            ring = std::make_unique<uring>(depth, buffer_size);
+        } catch(const std::exception& ex) {
+            if (!unavailable.exchange(true)){
+                std::cerr << "io_uring недоступен, используется pread: " << ex.what() << std::endl;
+            }
+            return nullptr;
+        }
+        return ring.get();
+    }
+
+    char* buffer(unsigned slot){
+        return _buffers.get() + slot * _buffer_size;
+    }
+
+    unsigned depth() const {
+        return _depth;
+    }
+
+    std::size_t buffer_size() const {
+        return _buffer_size;
+    }
+
+    /**
+     * @brief Занимает свободный слот
+     * @return false, если все слоты заняты
+    */
+    bool acquire(unsigned& slot){
+        if (_free.empty()) return false;
+        slot = _free.back();
+        _free.pop_back();
+        return true;
+    }
+
+    void release(unsigned slot){
+        _free.push_back(slot);
+    }
+
+    /**
+     * @brief Ставит в очередь чтение в буфер слота. Результат придет с user_data == slot
+    */
+    void read(unsigned slot, int fd, std::uint64_t offset, std::size_t len){
+        unsigned tail = *_sq_tail;
+        unsigned idx  = tail & *_sq_mask;
+
+        io_uring_sqe* sqe = &_sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = _fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<std::uint64_t>(buffer(slot));
+        sqe->len       = static_cast<std::uint32_t>(len);
+        sqe->off       = offset;
+        sqe->buf_index = static_cast<std::uint16_t>(slot);
+        sqe->user_data = slot;
+
+        _sq_array[idx] = idx;
+        __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        _unsubmitted++;
+    }
+
+    /**
+     * @brief Отправляет подготовленные чтения и ждет хотя бы одно завершение
+    */
+    void submit_and_wait(){
+        while (_enter(_fd, _unsubmitted, 1, IORING_ENTER_GETEVENTS) < 0){
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY){
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+        }
+        _unsubmitted = 0;
+    }
+
+    /**
+     * @brief Забирает одно завершенное чтение
+     * @arg slot Слот чтения
+     * @arg result Кол-во прочитанных байт или -errno
+     * @return false, если завершенных чтений нет
+    */
+    bool reap(unsigned& slot, int& result){
+        unsigned head = *_cq_head;
+        if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) return false;
+
+        const io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+        slot   = static_cast<unsigned>(cqe.user_data);
+        result = cqe.res;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
@@ -0,0 +1,423 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Режим наблюдения.
+ * После первого прохода следит за директориями через inotify и хранит индекс
+ * файлов по размеру. Изменившиеся файлы перечитываются, а группы их размеров
+ * сравниваются заново; хэши неизменных файлов берутся из кэша запуска.
+ * Выводятся только изменения групп дубликатов: added и removed
+*/
+class Watcher {
+private:
+    /* Пауза без событий, после которой накопленные изменения обрабатываются, мс */
+    static constexpr int _settle_ms = 200;
+    /* Наибольшая задержка обработки при непрерывном потоке событий, мс */
+    static constexpr int _max_delay_ms = 2000;
+    /* Период проверки флага остановки без событий, мс */
+    static constexpr int _idle_ms = 1000;
+    /* События, на которые подписывается каждая директория */
+    static constexpr std::uint32_t _mask = IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE |
+        IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+
+    /**
+     * @brief Собирает группы одного пересчета
+    */
+    class collector : public group_sink {
+    public:
+        std::mutex mutex;
+        std::vector<dup_group> groups;
+
+        void push(std::unique_ptr<dup_group> g) override {
+            std::lock_guard<std::mutex> lock(mutex);
+            groups.push_back(std::move(*g));
+        }
+    };
+
+    int _fd = -1;
+    /* Наблюдаемые директории: по дескриптору наблюдения и по пути */
+    std::unordered_map<int, boost::filesystem::path> _dirs;
+    std::map<std::string, int> _wds;
+
+    /* Отобранный файл: размер, устройство и inode */
+    struct file_stat {
+        std::uint64_t size;
+        std::uint64_t dev;
+        std::uint64_t ino;
+    };
+
+    /* Отобранные файлы. Упорядочены по пути, чтобы удалять директории целиком */
+    std::map<std::string, file_stat> _files;
+    /* Файлы каждого размера */
+    std::unordered_map<std::uint64_t, std::set<std::string>> _sizes;
+    /* Выведенные группы дубликатов каждого размера, пути групп отсортированы */
+    std::unordered_map<std::uint64_t, std::vector<dup_group>> _groups;
+
+    /* Пути, по которым пришли события, и размеры, группы которых надо пересчитать */
+    std::set<std::string> _touched;
+    std::set<std::uint64_t> _dirty;
+    /* Очередь событий переполнилась, часть изменений потеряна */
+    bool _overflow = false;
+
+    /* Маски и исключения, собранные один раз */
+    const scan_filter _filter;
+    result_writer _writer;
+
+    static std::atomic<bool>& _stopped(){
+        static std::atomic<bool> stopped{false};
+        return stopped;
+    }
+
+    static void _on_signal(int){
+        _stopped().store(true, std::memory_order_relaxed);
+    }
+
+    static void _error(const boost::filesystem::path& path, int code){
+        boost::unique_lock<boost::mutex> scoped_lock(io_mutex);
+        std::cerr << "Не удалось наблюдать за " << path << ": " << std::strerror(code) << std::endl;
+    }
+
+    void _index(const std::string& path, std::uint64_t size, std::uint64_t dev, std::uint64_t ino){
+        _files.emplace(path, file_stat{size, dev, ino});
+        _sizes[size].insert(path);
+        _dirty.insert(size);
+    }
+
+    void _unindex(const std::string& path, std::uint64_t size){
+        auto it = _sizes.find(size);
+        if (it != _sizes.end()){
+            it->second.erase(path);
+            if (it->second.empty()) _sizes.erase(it);
+        }
+        _dirty.insert(size);
+    }
+
+    /**
+     * @brief Перечитывает файл после события: убирает старую запись
+     * и добавляет новую, если файл проходит фильтры сканирования
+    */
+    void _update(const std::string& path){
+        auto it = _files.find(path);
+        if (it != _files.end()){
+            _unindex(path, it->second.size);
+            _files.erase(it);
+        }
+
+        const auto& conf = config::Config::instance();
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return;
+        if (static_cast<std::uintmax_t>(st.st_size) < conf.minfile) return;
+        if (!_filter.name(boost::filesystem::path(path).filename().c_str())) return;
+
+        _index(path, st.st_size, st.st_dev, st.st_ino);
+    }
+
+    /**
+     * @brief Подписывается на директорию и (при рекурсивном сканировании) на ее поддиректории
+     * @arg collect Отметить найденные файлы как измененные - для директорий,
+     * появившихся после первого прохода
+    */
+    void _watch_tree(const boost::filesystem::path& root, bool collect){
+        const auto& conf = config::Config::instance();
+        std::vector<boost::filesystem::path> stack{root};
+
+        while (!stack.empty()){
+            boost::filesystem::path dir = std::move(stack.back());
+            stack.pop_back();
+
+            int wd = ::inotify_add_watch(_fd, dir.c_str(), _mask);
+            if (wd < 0){
+                _error(dir, errno);
+                continue;
+            }
+            /* Та же директория по другому пути (ссылка) уже наблюдается */
+            if (_dirs.count(wd)) continue;
+            _dirs[wd] = dir;
+            _wds[dir.string()] = wd;
+
+            if (!collect && !conf.level) continue;
+
+            int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            DIR* d  = (dfd < 0) ? nullptr : ::fdopendir(dfd);
+            if (d == nullptr){
+                if (dfd >= 0) ::close(dfd);
+                continue;
+            }
+
+            while (struct dirent* e = ::readdir(d)){
+                if (std::strcmp(e->d_name, ".") == 0 || std::strcmp(e->d_name, "..") == 0) continue;
+
+                boost::filesystem::path path = dir / e->d_name;
+                bool is_dir = e->d_type == DT_DIR;
+                if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK){
+                    struct stat st;
+                    is_dir = ::fstatat(dfd, e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+                }
+
+                if (is_dir){
+                    if (conf.level && !_filter.excluded(path)){
+                        stack.push_back(std::move(path));
+                    }
+                } else if (collect){
+                    _touched.insert(path.string());
+                }
+            }
+
+            ::closedir(d);
+        }
+    }
+
+    /**
+     * @brief Забывает директорию: снимает наблюдение с нее и поддиректорий
+     * и убирает их файлы из индекса
+    */
+    void _drop_tree(const boost::filesystem::path& root){
+        const std::string dir = root.string();
+        const std::string prefix = dir + '/';
+
+        auto forget = [&](std::map<std::string, int>::iterator it){
+            ::inotify_rm_watch(_fd, it->second);
+            _dirs.erase(it->second);
+            return _wds.erase(it);
+        };
+
+        auto self = _wds.find(dir);
+        if (self != _wds.end()) forget(self);
+        for (auto it = _wds.lower_bound(prefix); it != _wds.end();){
+            if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+            it = forget(it);
+        }
+
+        for (auto it = _files.lower_bound(prefix); it != _files.end();){
+            if (it->first.compare(0, prefix.size(), prefix) != 0) break;
+            _unindex(it->first, it->second.size);
+            it = _files.erase(it);
+        }
+    }
+
+    void _event(const struct inotify_event& e){
+        if (e.mask & IN_Q_OVERFLOW){
+            _overflow = true;
+            return;
+        }
+
+        auto dir = _dirs.find(e.wd);
+        if (dir == _dirs.end()) return;
+
+        /* Наблюдение снято: директория удалена или перемещена */
+        if (e.mask & IN_IGNORED){
+            _drop_tree(boost::filesystem::path(dir->second));
+            return;
+        }
+        if (e.len == 0) return;
+
+        boost::filesystem::path path = dir->second / e.name;
+        if (!(e.mask & IN_ISDIR)){
+            _touched.insert(path.string());
+            return;
+        }
+
+        if (e.mask & (IN_DELETE | IN_MOVED_FROM)){
+            _drop_tree(path);
+        } else if ((e.mask & (IN_CREATE | IN_MOVED_TO)) && config::Config::instance().level && !_filter.excluded(path)){
+            _watch_tree(path, true);
+        }
+    }
+
+    /**
+     * @brief Читает все события, накопившиеся в очереди
+     * @return false, если очередь была пуста
+    */
+    bool _read_events(){
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        bool any = false;
+
+        while (true){
+            ssize_t len = ::read(_fd, buffer, sizeof(buffer));
+            if (len <= 0) break;
+
+            any = true;
+            for (char* p = buffer; p < buffer + len;){
+                auto e = reinterpret_cast<const struct inotify_event*>(p);
+                _event(*e);
+                p += sizeof(struct inotify_event) + e->len;
+            }
+        }
+        return any;
+    }
+
+    /**
+     * @brief Часть событий потеряна - индекс строится заново обходом директорий
+    */
+    void _rescan(){
+        std::cerr << "Очередь событий inotify переполнена, директории сканируются заново" << std::endl;
+
+        for (const auto& [size, files] : _sizes) _dirty.insert(size);
+        _sizes.clear();
+        _files.clear();
+        _touched.clear();
+
+        for (const auto& [wd, dir] : _dirs) ::inotify_rm_watch(_fd, wd);
+        _dirs.clear();
+        _wds.clear();
+
+        const auto& conf = config::Config::instance();
+        for (const auto& path : _filter.roots(conf.includes, conf.level)){
+            _watch_tree(path, true);
+        }
+        _overflow = false;
+    }
+
+    void _emit(const dup_group& g, const char* event){
+        auto out = std::make_unique<dup_group>(g);
+        out->event = event;
+        _writer.push(std::move(out));
+    }
+
+    /**
+     * @brief Пересчитывает группы дубликатов измененных размеров
+     * и выводит разницу с прошлым результатом
+    */
+    void _refresh(){
+        for (const auto& path : _touched) _update(path);
+        _touched.clear();
+        if (_dirty.empty()) return;
+
+        std::shared_ptr<IKeeper> keeper = make_keeper();
+        for (auto size : _dirty){
+            auto it = _sizes.find(size);
+            if (it == _sizes.end() || it->second.size() < 2) continue;
+
+            std::vector<file_entry> files;
+            for (const auto& path : it->second){
+                const file_stat& f = _files.at(path);
+                files.emplace_back(path, size, f.dev, f.ino);
+            }
+            keeper->add_files(files);
+        }
+
+        collector found;
+        Reader().process(keeper, found);
+
+        std::unordered_map<std::uint64_t, std::vector<dup_group>> fresh;
+        for (auto& g : found.groups){
+            std::sort(g.paths.begin(), g.paths.end());
+            fresh[g.size].push_back(std::move(g));
+        }
+
+        auto same = [](const dup_group& a, const dup_group& b){ return a.paths == b.paths; };
+        for (auto size : _dirty){
+            auto& was = _groups[size];
+            auto& now = fresh[size];
+
+            for (const auto& g : was){
+                if (std::none_of(now.begin(), now.end(), [&](const dup_group& n){ return same(g, n); })){
+                    _emit(g, "removed");
+                }
+            }
+            for (const auto& g : now){
+                if (std::none_of(was.begin(), was.end(), [&](const dup_group& w){ return same(g, w); })){
+                    _emit(g, "added");
+                }
+            }
+
+            if (now.empty()) _groups.erase(size);
+            else was = std::move(now);
+        }
+        _dirty.clear();
+    }
+
+public:
+    /**
+     * @arg out Поток вывода изменений
+     * @arg format Формат вывода: text, nul или jsonl
+    */
+    Watcher(std::ostream& out, const std::string& format) :
+        _filter(scan_filter::from_config()),
+        _writer(out, format)
+    {}
+
+    ~Watcher() {
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    Watcher(const Watcher&) = delete;
+
+    /**
+     * @brief Подписывается на изменения директорий сканирования.
+     * Вызывается до первого сканирования, чтобы не потерять изменения во время него
+    */
+    void subscribe(){
+        _fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_fd < 0){
+            std::cerr << "Не удалось запустить inotify: " << std::strerror(errno) << std::endl;
+            throw std::exception();
+        }
+
+        /* Те же директории, что обходит Scaner: без исключенных и вложенных */
+        const auto& conf = config::Config::instance();
+        for (const auto& path : _filter.roots(conf.includes, conf.level)){
+            _watch_tree(path, false);
+        }
+    }
+
+    /**
+     * @brief Строит индекс по результату первого сканирования
+     * и выводит все найденные группы как added
+    */
+    void seed(std::shared_ptr<IKeeper> keeper){
+        for (auto group : keeper->group_by_size(1)){
+            for (auto it = group.first; it != group.second; it++){
+                _index(it->path.string(), group.size, it->dev, it->ino);
+            }
+        }
+        step();
+    }
+
+    /**
+     * @brief Обрабатывает накопленные события и выводит изменения групп
+    */
+    void step(){
+        _read_events();
+        if (_overflow) _rescan();
+        _refresh();
+    }
+
+    /**
+     * @brief Обрабатывает события до SIGINT или SIGTERM.
+     * Изменения копятся, пока не наступит пауза в событиях
+    */
+    void run(){
+        struct sigaction action{};
+        action.sa_handler = _on_signal;
+        ::sigemptyset(&action.sa_mask);
+        ::sigaction(SIGINT, &action, nullptr);
+        ::sigaction(SIGTERM, &action, nullptr);
+
+        struct pollfd p{_fd, POLLIN, 0};
+        bool pending = false;
+        auto since = std::chrono::steady_clock::now();
+
+        while (!_stopped().load(std::memory_order_relaxed)){
+            int ready = ::poll(&p, 1, pending ? _settle_ms : _idle_ms);
+            if (ready < 0){
+                if (errno == EINTR) continue;
+                std::cerr << "Ошибка ожидания событий: " << std::strerror(errno) << std::endl;
+                throw std::exception();
+            }
+
+            if (ready > 0){
+                _read_events();
+                if (!pending) since = std::chrono::steady_clock::now();
+                pending = true;
+                if (std::chrono::steady_clock::now() - since < std::chrono::milliseconds(_max_delay_ms)) continue;
+            }
+
+            if (pending){
+                step();
+                pending = false;
+            }
+        }
+    }
+};
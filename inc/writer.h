@@ -0,0 +1,210 @@
+#pragma once
+
+#include "babayan.hpp"
+
+/**
+ * @brief Найденная группа дубликатов, готовая к выводу
+*/
+struct dup_group {
+    /* Размер файлов группы */
+    std::uint64_t size;
+    /* Хэш всего файла. Не известен, если группа сравнивалась побайтно */
+    digest_t digest;
+    bool has_digest;
+    std::vector<std::string> paths;
+    /* Событие режима наблюдения (added, removed), пустое - обычный вывод */
+    const char* event = nullptr;
+    /* Группа - пути одного inode (--hardlinks separate) */
+    bool hardlinked = false;
+};
+
+/**
+ * @brief Получатель найденных групп дубликатов
+*/
+class group_sink {
+public:
+    virtual ~group_sink() = default;
+    /**
+     * @brief Принимает группу. Вызывается из нескольких потоков
+    */
+    virtual void push(std::unique_ptr<dup_group> g) = 0;
+};
+
+/**
+ * @brief Поток вывода результатов.
+ * Рабочие потоки кладут группы в lock-free очередь и сразу продолжают работу,
+ * единственный поток-писатель форматирует их в большой буфер и пишет в поток вывода
+*/
+class result_writer : public group_sink {
+private:
+    /* Порог буфера, после которого он записывается в поток вывода */
+    static constexpr std::size_t _flush_size = 1 << 20;
+
+    std::ostream& _out;
+    std::string _format;
+    boost::lockfree::queue<dup_group*> _queue{1024};
+    /* Счетчик добавленных групп, на нем писатель ждет новых данных */
+    std::atomic<std::uint64_t> _pushed{0};
+    std::atomic<bool> _stop{false};
+    std::string _buffer;
+    std::thread _thread;
+
+    /**
+     * @brief Путь в кавычках, как его выводит operator<< boost::filesystem::path
+    */
+    void _quoted(const std::string& s){
+        _buffer += '"';
+        for (char c : s){
+            if (c == '"' || c == '&') _buffer += '&';
+            _buffer += c;
+        }
+        _buffer += '"';
+    }
+
+    void _json_string(const std::string& s){
+        static const char hex[] = "0123456789abcdef";
+        _buffer += '"';
+        for (unsigned char c : s){
+            switch (c){
+                case '"':  _buffer += "\\\""; break;
+                case '\\': _buffer += "\\\\"; break;
+                case '\n': _buffer += "\\n";  break;
+                case '\t': _buffer += "\\t";  break;
+                default:
+                    if (c < 0x20){
+                        _buffer += "\\u00";
+                        _buffer += hex[c >> 4];
+                        _buffer += hex[c & 0xf];
+                    } else {
+                        _buffer += static_cast<char>(c);
+                    }
+            }
+        }
+        _buffer += '"';
+    }
+
+    void _format_group(const dup_group& g){
+        if (_format == "nul"){
+            /* Каждый путь завершается NUL, группа - дополнительным NUL. Событие - первое слово группы */
+            if (g.event){
+                _buffer += g.event;
+                _buffer += '\0';
+            }
+            if (g.hardlinked){
+                _buffer += "hardlinked";
+                _buffer += '\0';
+            }
+            for (const auto& p : g.paths){
+                _buffer += p;
+                _buffer += '\0';
+            }
+            _buffer += '\0';
+        } else if (_format == "jsonl"){
+            _buffer += '{';
+            if (g.event){
+                _buffer += "\"event\":\"";
+                _buffer += g.event;
+                _buffer += "\",";
+            }
+            if (g.hardlinked) _buffer += "\"hardlinked\":true,";
+            _buffer += "\"size\":" + std::to_string(g.size) + ",\"digest\":";
+            if (g.has_digest){
+                char digest[35];
+                std::snprintf(digest, sizeof(digest), "\"%016llx%016llx\"",
+                    static_cast<unsigned long long>(g.digest.hi), static_cast<unsigned long long>(g.digest.lo));
+                _buffer += digest;
+            } else {
+                _buffer += "null";
+            }
+            _buffer += ",\"files\":[";
+            for (std::size_t i = 0; i < g.paths.size(); i++){
+                if (i) _buffer += ',';
+                _json_string(g.paths[i]);
+            }
+            _buffer += "]}\n";
+        } else {
+            /* Пути в кавычках, поэтому строка события без кавычек с ними не спутается */
+            if (g.event){
+                _buffer += g.event;
+                _buffer += '\n';
+            }
+            if (g.hardlinked) _buffer += "hardlinked\n";
+            for (const auto& p : g.paths){
+                _quoted(p);
+                _buffer += '\n';
+            }
+            _buffer += '\n';
+        }
+    }
+
+    void _write(){
+        _out.write(_buffer.data(), _buffer.size());
+        _buffer.clear();
+    }
+
+    /**
+     * @brief Выводит все группы, которые сейчас есть в очереди
+     * @return false, если очередь была пуста
+    */
+    bool _drain(){
+        dup_group* g;
+        if (!_queue.pop(g)) return false;
+
+        phase_timer timer("output");
+        do {
+            std::unique_ptr<dup_group> owned(g);
+            _format_group(*owned);
+            if (_buffer.size() >= _flush_size) _write();
+        } while (_queue.pop(g));
+
+        /* Очередь опустела - отдать накопленное потребителю */
+        _write();
+        _out.flush();
+        return true;
+    }
+
+    void _loop(){
+        while (true){
+            std::uint64_t seen = _pushed.load(std::memory_order_acquire);
+            if (_drain()) continue;
+            if (_stop.load(std::memory_order_acquire)){
+                /* Группы, добавленные до остановки, уже видны в очереди */
+                while (_drain());
+                return;
+            }
+            _pushed.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+public:
+    /**
+     * @brief Запускает поток-писатель
+     * @arg out Поток вывода результатов
+     * @arg format Формат вывода: text, nul или jsonl
+    */
+    result_writer(std::ostream& out, const std::string& format) : _out(out), _format(format) {
+        _buffer.reserve(_flush_size + 4096);
+        _thread = std::thread([this](){ _loop(); });
+    }
+
+    /**
+     * @brief Дожидается вывода всех групп
+    */
+    ~result_writer() {
+        _stop.store(true, std::memory_order_release);
+        _pushed.fetch_add(1, std::memory_order_release);
+        _pushed.notify_one();
+        _thread.join();
+    }
+
+    result_writer(const result_writer&) = delete;
+
+    /**
+     * @brief Ставит группу в очередь на вывод. Потокобезопасно
+    */
+    void push(std::unique_ptr<dup_group> g) override {
+        _queue.push(g.release());
+        _pushed.fetch_add(1, std::memory_order_release);
+        _pushed.notify_one();
+    }
+};
@@ -10,16 +10,59 @@ int main(int argc, char *argv[]){
             return EXIT_SUCCESS;
         }
 
+        /* Загрузить хэши файлов, посчитанные в прошлых запусках */
+        if(!config::Config::instance().cache.empty()){
+            hash_cache::instance().load(config::Config::instance().cache);
+        }
+
+        /* В режиме наблюдения подписаться на изменения до сканирования */
+        std::unique_ptr<Watcher> watcher;
+        if(config::Config::instance().watch){
+            hash_cache::instance().live();
+            watcher = std::make_unique<Watcher>(std::cout, config::Config::instance().format);
+            watcher->subscribe();
+        }
+
         /* Создать хранилище файлов */
-        std::shared_ptr<IKeeper> keeper = std::make_shared<Keeper>();
-        
+        std::shared_ptr<IKeeper> keeper = make_keeper();
+        if(config::Config::instance().pipeline){
+            keeper = std::make_shared<PipelineKeeper>(keeper);
+        }
+
         /* В соответсвии с конфигом, отобрать файлы для сканирования*/
         Scaner scaner(keeper);
-        scaner.collect();
+        {
+            phase_timer timer("scan");
+            scaner.collect();
+        }
 
         /* Найти дубликаты */
-        Reader reader;
-        reader.process(keeper);
+        if(watcher){
+            {
+                progress line(config::Config::instance().progress);
+                phase_timer timer("search");
+                watcher->seed(keeper);
+            }
+            keeper.reset();
+            watcher->run();
+            watcher.reset();
+        } else {
+            Reader reader;
+            progress line(config::Config::instance().progress);
+            phase_timer timer("search");
+            reader.process(keeper);
+        }
+
+        hash_cache::instance().save();
+
+        /* Вывести статистику запуска */
+        const std::string& stats_path = config::Config::instance().stats;
+        if (stats_path == "-"){
+            stats::instance().write_json(std::cerr);
+        } else if (!stats_path.empty()){
+            std::ofstream out(stats_path);
+            stats::instance().write_json(out);
+        }
     }
     catch(const std::exception& e)
     {
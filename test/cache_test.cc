@@ -0,0 +1,260 @@
+#define BOOST_TEST_MODULE cache_test
+
+#include <boost/test/unit_test.hpp>
+
+#include "babayan.hpp"
+
+namespace fs = boost::filesystem;
+
+/**
+ * @brief Временная директория с файлом кэша
+*/
+struct cache_fixture {
+    fs::path root;
+    fs::path cache_file;
+
+    cache_fixture() {
+        root  = fs::temp_directory_path() / fs::unique_path("babayan-cache-%%%%-%%%%");
+        cache_file = root / "cache.bin";
+        fs::create_directories(root / "data");
+
+        auto& conf = config::Config::instance();
+        conf.block        = 64;
+        conf.block_max    = 256;
+        conf.block_growth = 2;
+        conf.hash    = "crc32";
+        conf.threads = 2;
+        conf.reader  = "mmap";
+        conf.compare = "hash";
+        conf.sample  = 16;
+        conf.samples = 1;
+        conf.format  = "text";
+        conf.cache_policy = "sequential";
+        conf.hardlinks = "merge";
+    }
+
+    ~cache_fixture() {
+        hash_cache::instance().load(fs::path());
+        fs::remove_all(root);
+    }
+
+    void write(const std::string& name, const std::string& data){
+        std::ofstream(root / "data" / name, std::ios::binary) << data;
+    }
+
+    cache_record key(const std::string& name){
+        struct stat st;
+        ::stat((root / "data" / name).c_str(), &st);
+        return cache_record::from_stat(st);
+    }
+
+    /**
+     * @brief Ищет дубликаты в директории data с кэшем, как это делает отдельный запуск
+     * @return Вывод Reader
+    */
+    std::string run(){
+        auto& cache = hash_cache::instance();
+        cache.load(cache_file);
+
+        auto keeper = std::make_shared<Keeper>();
+        for (auto& e : fs::directory_iterator(root / "data")){
+            struct stat st;
+            ::stat(e.path().c_str(), &st);
+            keeper->add_files({file_entry(e.path(), st.st_size, st.st_dev, st.st_ino)});
+        }
+
+        std::stringstream out;
+        auto old = std::cout.rdbuf(out.rdbuf());
+        Reader reader;
+        reader.process(keeper);
+        std::cout.rdbuf(old);
+
+        cache.save();
+        return out.str();
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(cache_test, cache_fixture)
+
+BOOST_AUTO_TEST_CASE(test_round_trip)
+{
+    write("a", "abc");
+    auto& cache = hash_cache::instance();
+    cache.load(cache_file);
+
+    cache_record found;
+    BOOST_CHECK(!cache.lookup(key("a"), found));
+
+    cache_record record = key("a");
+    record.digest    = digest_t{1, 2};
+    record.prefix[0] = digest_t{3, 4};
+    record.signature = digest_t{5, 6};
+    record.flags    |= cache_record::has_signature;
+    cache.store(record);
+    cache.save();
+
+    cache.load(cache_file);
+    BOOST_CHECK(cache.lookup(key("a"), found));
+    BOOST_CHECK(found.digest == (digest_t{1, 2}));
+    BOOST_CHECK(found.prefix[0] == (digest_t{3, 4}));
+    BOOST_CHECK(found.signed_as(key("a")));
+
+    /* Другие параметры выборок - подпись не годится, хэш годится */
+    config::Config::instance().samples = 2;
+    BOOST_CHECK(cache.lookup(key("a"), found));
+    BOOST_CHECK(!found.signed_as(key("a")));
+}
+
+BOOST_AUTO_TEST_CASE(test_stale)
+{
+    write("a", "abc");
+    auto& cache = hash_cache::instance();
+    cache.load(cache_file);
+    cache_record record = key("a");
+    cache.store(record);
+    cache.save();
+
+    cache.load(cache_file);
+    cache_record found;
+    BOOST_CHECK(cache.lookup(key("a"), found));
+
+    /* Тот же размер, другое время модификации */
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000, 0}};
+    ::utimensat(AT_FDCWD, (root / "data" / "a").c_str(), times, 0);
+    BOOST_CHECK(!cache.lookup(key("a"), found));
+}
+
+BOOST_AUTO_TEST_CASE(test_block_schedule)
+{
+    write("a", "abc");
+    auto& cache = hash_cache::instance();
+    cache.load(cache_file);
+    cache.store(key("a"));
+    cache.save();
+
+    cache.load(cache_file);
+    cache_record found;
+    auto& conf = config::Config::instance();
+    conf.block = 128;
+    BOOST_CHECK(!cache.lookup(key("a"), found));
+    conf.block = 64;
+    conf.block_growth = 4;
+    BOOST_CHECK(!cache.lookup(key("a"), found));
+    conf.block_growth = 2;
+    BOOST_CHECK(cache.lookup(key("a"), found));
+}
+
+BOOST_AUTO_TEST_CASE(test_incompatible)
+{
+    std::ofstream(cache_file.string(), std::ios::binary) << std::string(100, 'x');
+    write("a", "abc");
+
+    auto& cache = hash_cache::instance();
+    cache.load(cache_file);
+    cache_record found;
+    BOOST_CHECK(!cache.lookup(key("a"), found));
+
+    cache.store(key("a"));
+    cache.save();
+    cache.load(cache_file);
+    BOOST_CHECK(cache.lookup(key("a"), found));
+}
+
+BOOST_AUTO_TEST_CASE(test_reader)
+{
+    /* С подписью по выборкам и только по хэшам начала файла */
+    for (std::size_t sample : {16, 0}){
+        config::Config::instance().sample = sample;
+        fs::remove_all(root / "data");
+        fs::remove(cache_file);
+        fs::create_directories(root / "data");
+
+        std::string base(5000, 'a');
+        write("dup1", base);
+        write("dup2", base);
+        /* Файлы того же размера, отличающиеся в первом, втором и последнем блоке */
+        for (int i = 0; i < 9; i++){
+            std::string other = base;
+            other[i % 3 == 0 ? 0 : i % 3 == 1 ? 100 : 4999] = static_cast<char>('b' + i);
+            write("other" + std::to_string(i), other);
+        }
+
+        auto& s = stats::instance();
+        auto read = s.total(&stat_counters::bytes_read);
+        std::string first = run();
+        auto first_read = s.total(&stat_counters::bytes_read) - read;
+
+        /* Повторный запуск: дубликаты из кэша, отличающиеся файлы отсеиваются не дочитываясь */
+        auto hits = s.total(&stat_counters::cache_hits);
+        read = s.total(&stat_counters::bytes_read);
+        std::string second = run();
+        BOOST_TEST_CONTEXT("sample " << sample){
+            BOOST_CHECK_EQUAL(second, first);
+            /* Без выборок файлы, отличающиеся в последнем блоке, дочитаны и тоже попали в кэш */
+            BOOST_CHECK_GE(s.total(&stat_counters::cache_hits) - hits, 2);
+            BOOST_CHECK_LT(s.total(&stat_counters::bytes_read) - read, first_read);
+        }
+
+        /* Новая копия находится по хэшам из кэша */
+        write("dup3", base);
+        std::string third = run();
+        BOOST_CHECK_EQUAL(std::count(third.begin(), third.end(), '\n'), 4);
+        BOOST_CHECK(third.find("dup3") != std::string::npos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_partial)
+{
+    /* Отсеянные по подписи и по второму блоку файлы кэшируются частично и больше не читаются */
+    for (std::size_t sample : {16, 0}){
+        config::Config::instance().sample = sample;
+        fs::remove_all(root / "data");
+        fs::remove(cache_file);
+        fs::create_directories(root / "data");
+
+        for (int i = 0; i < 5; i++){
+            std::string data(5000, 'a');
+            data[100] = static_cast<char>('b' + i);
+            data[2500] = static_cast<char>('b' + i);
+            write("u" + std::to_string(i), data);
+        }
+
+        run();
+        auto& s = stats::instance();
+        auto partial = s.total(&stat_counters::cache_partial);
+        auto read    = s.total(&stat_counters::bytes_read);
+        std::string out = run();
+
+        BOOST_TEST_CONTEXT("sample " << sample){
+            BOOST_CHECK(out.empty());
+            BOOST_CHECK_EQUAL(s.total(&stat_counters::cache_partial) - partial, 5);
+            BOOST_CHECK_EQUAL(s.total(&stat_counters::bytes_read) - read, 0);
+        }
+
+        /* Копия одного из файлов читается и находится, несмотря на частичные записи */
+        fs::copy_file(root / "data" / "u3", root / "data" / "copy");
+        out = run();
+        BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+        BOOST_CHECK(out.find("copy") != std::string::npos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_auto)
+{
+    /* Маленькие группы в режиме auto хэшируются, чтобы хэши попали в кэш */
+    config::Config::instance().compare = "auto";
+    std::string base(1000, 'a');
+    write("dup1", base);
+    write("dup2", base);
+
+    run();
+    BOOST_CHECK_GT(fs::file_size(cache_file), sizeof(cache_record));
+
+    auto& s = stats::instance();
+    auto hits = s.total(&stat_counters::cache_hits);
+    std::string out = run();
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::cache_hits) - hits, 2);
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,132 @@
+#define BOOST_TEST_MODULE hasher_test
+
+#include <boost/test/unit_test.hpp>
+
+#include "babayan.hpp"
+
+BOOST_AUTO_TEST_SUITE(hasher_test)
+
+/* Хэш от данных, поданных двумя блоками, должен совпадать с хэшем от всех данных сразу */
+template<typename Hasher>
+digest_t split_hash(const std::string& data, std::size_t at){
+    Hasher h;
+    h.next_hash(data.data(), at);
+    return h.next_hash(data.data() + at, data.size() - at);
+}
+
+BOOST_AUTO_TEST_CASE(test_crc32)
+{
+    std::string data = "123456789";
+    BOOST_CHECK(split_hash<crc32_hasher>(data, 4) == (digest_t{0, 0xcbf43926}));
+}
+
+BOOST_AUTO_TEST_CASE(test_md5)
+{
+    std::string data = "hello world";
+    digest_t d = split_hash<md5_hasher>(data, 6);
+    BOOST_CHECK_EQUAL(d.hi, 0x5eb63bbbe01eeed0ULL);
+    BOOST_CHECK_EQUAL(d.lo, 0x93cb22bb8f5acdc3ULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_crc32c)
+{
+    std::string data = "123456789";
+    BOOST_CHECK(split_hash<crc32c_hasher>(data, 3) == (digest_t{0, 0xe3069283}));
+
+    /* Аппаратная и программная реализации совпадают на невыровненных данных */
+    std::string big(1000, 0);
+    for (std::size_t i = 0; i < big.size(); i++) big[i] = static_cast<char>(i * 7);
+    auto p = reinterpret_cast<const unsigned char*>(big.data()) + 3;
+    BOOST_CHECK_EQUAL(crc32c_detail::kernel()(~0u, p, 990), crc32c_detail::software(~0u, p, 990));
+}
+
+/* Хэш от данных, поданных одним блоком */
+template<typename Hasher>
+digest_t whole_hash(const std::string& data){
+    Hasher h;
+    return h.next_hash(data.data(), data.size());
+}
+
+#ifdef BABAYAN_WITH_XXHASH
+BOOST_AUTO_TEST_CASE(test_xxh3)
+{
+    /* Эталон XXH3_64bits от пустых данных */
+    BOOST_CHECK(whole_hash<xxh3_hasher>("") == (digest_t{0, 0x2d06800538d394c2ULL}));
+    std::string data(1000, 0);
+    for (std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<char>(i * 7);
+    BOOST_CHECK(split_hash<xxh3_hasher>(data, 333) == whole_hash<xxh3_hasher>(data));
+}
+
+BOOST_AUTO_TEST_CASE(test_xxh128)
+{
+    /* Эталон XXH3_128bits от пустых данных */
+    BOOST_CHECK(whole_hash<xxh128_hasher>("") == (digest_t{0x99aa06d3014798d8ULL, 0x6001c324468d497fULL}));
+    std::string data(1000, 0);
+    for (std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<char>(i * 7);
+    BOOST_CHECK(split_hash<xxh128_hasher>(data, 333) == whole_hash<xxh128_hasher>(data));
+}
+#endif
+
+#ifdef BABAYAN_WITH_BLAKE3
+BOOST_AUTO_TEST_CASE(test_blake3)
+{
+    /* Эталоны BLAKE3 от пустых данных и от одного нулевого байта, первые 16 байт */
+    BOOST_CHECK(whole_hash<blake3_hasher_t>("") == (digest_t{0xaf1349b9f5f9a1a6ULL, 0xa0404dea36dcc949ULL}));
+    BOOST_CHECK(whole_hash<blake3_hasher_t>(std::string(1, '\0')) == (digest_t{0x2d3adedff11b61f1ULL, 0x4c886e35afa03673ULL}));
+    std::string data(5000, 0);
+    for (std::size_t i = 0; i < data.size(); i++) data[i] = static_cast<char>(i * 7);
+    BOOST_CHECK(split_hash<blake3_hasher_t>(data, 1500) == whole_hash<blake3_hasher_t>(data));
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_names)
+{
+    for (const auto& name : hasher_names()){
+        BOOST_CHECK(make_hasher(name) != nullptr);
+    }
+    BOOST_CHECK(make_hasher("unknown") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_registry)
+{
+    std::string data = "hello world";
+    for (const auto& name : hasher_names()){
+        /* Экземпляр, выбранный по имени, - это класс с тем же именем и тем же результатом */
+        bool called = false;
+        BOOST_CHECK(with_hasher(name, [&]<typename H>(){
+            called = true;
+            BOOST_CHECK_EQUAL(std::string(H::name), name);
+
+            H h;
+            h.reset();
+            BOOST_CHECK(h.next_hash(data.data(), data.size()) == make_hasher(name)->next_hash(data.data(), data.size()));
+        }));
+        BOOST_CHECK(called);
+    }
+    BOOST_CHECK(!with_hasher("unknown", []<typename H>(){}));
+}
+
+BOOST_AUTO_TEST_CASE(test_zeros)
+{
+    /* Дыра длиннее блока нулей и не кратна ему */
+    const std::uint64_t n = zero_block_size * 2 + 12345;
+    std::vector<char> zeros(n, 0);
+    std::string data = "hello world";
+
+    for (const auto& name : hasher_names()){
+        auto plain  = make_hasher(name);
+        auto sparse = make_hasher(name);
+        plain->next_hash(data.data(), data.size());
+        sparse->next_hash(data.data(), data.size());
+
+        plain->next_hash(zeros.data(), n);
+        sparse->next_zeros(n);
+        sparse->next_zeros(0);
+        BOOST_TEST_CONTEXT(name){
+            BOOST_CHECK(plain->checksum() == sparse->checksum());
+            BOOST_CHECK(plain->next_hash(data.data(), data.size()) == sparse->next_hash(data.data(), data.size()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -49,4 +49,120 @@ BOOST_AUTO_TEST_CASE(test_1)
 }
 
 
+BOOST_AUTO_TEST_CASE(test_flat)
+{
+    std::shared_ptr<IKeeper> keeper = std::make_shared<FlatKeeper>();
+    const std::uint64_t big = 5ULL << 30;
+
+    keeper->add_file(boost::filesystem::path("/a/b/file1"), big);
+    keeper->add_file(boost::filesystem::path("/a/b/file2"), big);
+    keeper->add_file(boost::filesystem::path("/a/b/file1"), big);
+    keeper->add_file(boost::filesystem::path("/a/c//file3"), big + 1);
+    keeper->add_file(boost::filesystem::path("rel"), 7);
+    keeper->add_file(boost::filesystem::path("/x"), big + 1);
+    keeper->add_file(boost::filesystem::path("/a/b/file4"), 1ULL << 32);
+
+    std::vector<std::vector<std::string>> groups;
+    std::vector<std::size_t> counts;
+    for (auto g : keeper->group_by_size(2)){
+        counts.push_back(g.count);
+        groups.emplace_back();
+        for (auto it = g.first; it != g.second; it++){
+            BOOST_CHECK_EQUAL(it->size, g.size);
+            groups.back().push_back(it->path.string());
+        }
+    }
+
+    /* 7, 4 ГиБ, 5 ГиБ и 5 ГиБ + 1 - по возрастанию, повтор пути отброшен */
+    BOOST_CHECK((counts == std::vector<std::size_t>{1, 1, 2, 2}));
+    BOOST_CHECK(groups[0].empty());
+    BOOST_CHECK(groups[1].empty());
+    BOOST_CHECK((groups[2] == std::vector<std::string>{"/a/b/file1", "/a/b/file2"}));
+    BOOST_CHECK((groups[3] == std::vector<std::string>{"/a/c//file3", "/x"}));
+
+    std::size_t total = 0;
+    for (auto g : keeper->group_by_size()){
+        total += std::distance(g.first, g.second);
+    }
+    BOOST_CHECK_EQUAL(total, 6);
+}
+
+BOOST_AUTO_TEST_CASE(test_spill)
+{
+    /* Лимит меньше одной записи: каждый файл сбрасывается на диск отдельным прогоном */
+    std::shared_ptr<IKeeper> keeper = std::make_shared<SpillKeeper>(1);
+    const std::uint64_t big = 5ULL << 30;
+
+    keeper->add_file(boost::filesystem::path("/a/file1"), big);
+    keeper->add_file(boost::filesystem::path("/a/file2"), 3);
+    keeper->add_file(boost::filesystem::path("/a/file3"), big);
+    keeper->add_file(boost::filesystem::path("/a/file1"), big);
+    keeper->add_file(boost::filesystem::path("/a/file4"), 4);
+
+    std::vector<std::uint64_t> sizes;
+    std::vector<std::vector<std::string>> groups;
+    for (auto g : keeper->group_by_size(2)){
+        sizes.push_back(g.size);
+        groups.emplace_back();
+        for (auto it = g.first; it != g.second; it++){
+            groups.back().push_back(it->path.string());
+        }
+    }
+
+    BOOST_CHECK((sizes == std::vector<std::uint64_t>{3, 4, big}));
+    BOOST_CHECK(groups[0].empty());
+    BOOST_CHECK(groups[1].empty());
+    BOOST_CHECK((groups[2] == std::vector<std::string>{"/a/file1", "/a/file3"}));
+}
+
+BOOST_AUTO_TEST_CASE(test_spill_passes)
+{
+    /* Сотни прогонов сливаются в несколько проходов: одновременно открыто не больше двух */
+    std::shared_ptr<IKeeper> keeper = std::make_shared<SpillKeeper>(1);
+    for (int i = 0; i < 300; i++){
+        keeper->add_file(boost::filesystem::path("/p/f" + std::to_string(i)), i % 7);
+    }
+
+    std::vector<std::uint64_t> sizes;
+    std::size_t files = 0;
+    for (auto g : keeper->group_by_size()){
+        sizes.push_back(g.size);
+        for (auto it = g.first; it != g.second; it++){
+            BOOST_CHECK_EQUAL(it->size, g.size);
+            files++;
+        }
+    }
+
+    BOOST_CHECK((sizes == std::vector<std::uint64_t>{0, 1, 2, 3, 4, 5, 6}));
+    BOOST_CHECK_EQUAL(files, 300);
+}
+
+BOOST_AUTO_TEST_CASE(test_inodes)
+{
+    /* Каждое хранилище возвращает устройство и inode файлов */
+    std::vector<std::shared_ptr<IKeeper>> keepers = {
+        std::make_shared<Keeper>(), std::make_shared<FlatKeeper>(), std::make_shared<SpillKeeper>(1)
+    };
+    for (auto& keeper : keepers){
+        keeper->add_files({
+            file_entry("/d/a", 10, 1, 100),
+            file_entry("/d/b", 10, 1, 100),
+            file_entry("/d/c", 10, 1, 101),
+            /* Другое устройство, чем у остальных файлов директории */
+            file_entry("/d/m", 10, 2, 100),
+        });
+
+        std::map<std::string, std::pair<std::uint64_t, std::uint64_t>> ids;
+        for (auto g : keeper->group_by_size()){
+            for (auto it = g.first; it != g.second; it++) ids[it->path.string()] = {it->dev, it->ino};
+        }
+
+        BOOST_CHECK((ids["/d/a"] == std::make_pair<std::uint64_t, std::uint64_t>(1, 100)));
+        BOOST_CHECK((ids["/d/b"] == ids["/d/a"]));
+        BOOST_CHECK_EQUAL(ids["/d/c"].second, 101);
+        /* FlatKeeper не хранит устройство файла отдельно от директории - inode неизвестен */
+        BOOST_CHECK((ids["/d/m"].second == 0 || ids["/d/m"] == std::make_pair<std::uint64_t, std::uint64_t>(2, 100)));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,554 @@
+#define BOOST_TEST_MODULE reader_test
+
+#include <boost/test/unit_test.hpp>
+
+#include "babayan.hpp"
+
+namespace fs = boost::filesystem;
+
+/**
+ * @brief Временная директория с набором файлов для поиска дубликатов
+*/
+struct tree_fixture {
+    fs::path root;
+
+    tree_fixture() {
+        root = fs::temp_directory_path() / fs::unique_path("babayan-%%%%-%%%%");
+        fs::create_directories(root);
+
+        auto& conf = config::Config::instance();
+        conf.block   = 64;
+        conf.block_max    = 256;
+        conf.block_growth = 2;
+        conf.hash    = "crc32";
+        conf.threads = 2;
+        conf.reader  = "mmap";
+        conf.compare = "auto";
+        conf.sample  = 16;
+        conf.samples = 1;
+        conf.format  = "text";
+        conf.cache_policy = "sequential";
+        conf.hardlinks = "merge";
+    }
+
+    ~tree_fixture() {
+        fs::remove_all(root);
+    }
+
+    void write(const std::string& name, const std::string& data){
+        std::ofstream(root / name, std::ios::binary) << data;
+    }
+
+    /**
+     * @brief Запускает Reader по всем файлам директории
+     * @arg keeper Хранилище, в которое складываются файлы
+     * @return Вывод Reader
+    */
+    std::string run(std::shared_ptr<IKeeper> keeper = std::make_shared<Keeper>()){
+        for (auto& e : fs::directory_iterator(root)){
+            struct stat st;
+            ::stat(e.path().c_str(), &st);
+            keeper->add_files({file_entry(e.path(), st.st_size, st.st_dev, st.st_ino)});
+        }
+
+        std::stringstream out;
+        auto old = std::cout.rdbuf(out.rdbuf());
+        Reader reader;
+        reader.process(keeper);
+        std::cout.rdbuf(old);
+
+        return out.str();
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(reader_test, tree_fixture)
+
+BOOST_AUTO_TEST_CASE(test_refine)
+{
+    std::string base(1000, 'a');
+    std::string head = base, tail = base;
+    head[0] = 'b';
+    tail[999] = 'b';
+
+    write("dup1", base);
+    write("dup2", base);
+    write("head", head);
+    write("tail", tail);
+    write("tail2", tail);
+    write("single", "abc");
+
+    for (auto [reader, compare] : {std::pair{"mmap", "hash"}, {"pread", "hash"}, {"uring", "hash"}, {"mmap", "bytes"}, {"pread", "bytes"}}){
+        config::Config::instance().reader  = reader;
+        config::Config::instance().compare = compare;
+        std::string out = run();
+
+        BOOST_CHECK(out.find("dup1") != std::string::npos);
+        BOOST_CHECK(out.find("dup2") != std::string::npos);
+        BOOST_CHECK(out.find("tail2") != std::string::npos);
+        BOOST_CHECK(out.find("head") == std::string::npos);
+        BOOST_CHECK(out.find("single") == std::string::npos);
+        /* Две группы дубликатов, каждая завершается пустой строкой */
+        BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 6);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_large_group)
+{
+    /* Группа больше порога параллельного хэширования: 100 уникальных файлов и 10 пар */
+    for (int i = 0; i < 100; i++){
+        std::string data(500, 'x');
+        data[i * 5] = 'y';
+        write("u" + std::to_string(i), data);
+    }
+    for (int i = 0; i < 10; i++){
+        std::string data(500, 'z');
+        data[i] = 'y';
+        write("p" + std::to_string(i) + "a", data);
+        write("p" + std::to_string(i) + "b", data);
+    }
+
+    std::string out = run();
+
+    BOOST_CHECK(out.find("/u") == std::string::npos);
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 30);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_parts)
+{
+    /* Блоки больше слота io_uring читаются частями, хэш тот же, что у pread */
+    std::string base(3 << 20, 'a');
+    for (std::size_t i = 0; i < base.size(); i += 4093) base[i] = static_cast<char>(i);
+    std::string tail = base;
+    tail.back() = 'b';
+    write("dup1", base);
+    write("dup2", base);
+    write("tail", tail);
+    write("tail2", tail);
+
+    auto& conf = config::Config::instance();
+    conf.compare   = "hash";
+    conf.format    = "jsonl";
+    conf.block_max = 1 << 20;
+
+    conf.reader = "pread";
+    std::string expected = run();
+    conf.reader = "uring";
+    std::string out = run();
+
+    BOOST_CHECK_EQUAL(std::count(expected.begin(), expected.end(), '\n'), 2);
+    BOOST_CHECK_EQUAL(out, expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_formats)
+{
+    std::string base(1000, 'a');
+    write("dup1", base);
+    write("dup2", base);
+    write("single", "abc");
+
+    config::Config::instance().format = "nul";
+    std::string out = run();
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\0'), 3);
+    BOOST_CHECK(out.find('\n') == std::string::npos);
+    BOOST_CHECK(out.ends_with(std::string(2, '\0')));
+
+    config::Config::instance().format = "jsonl";
+    out = run();
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 1);
+    BOOST_CHECK(out.starts_with("{\"size\":1000,\"digest\":\""));
+    BOOST_CHECK(out.find("dup1") != std::string::npos);
+    BOOST_CHECK(out.find("dup2") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_pipeline)
+{
+    std::string base(1000, 'a');
+    std::string other = base;
+    other[500] = 'b';
+
+    write("dup1", base);
+    write("dup2", base);
+    write("other", other);
+    write("single", "abc");
+
+    auto& s = stats::instance();
+    auto speculated = s.total(&stat_counters::speculated);
+
+    std::string out = run(std::make_shared<PipelineKeeper>(std::make_shared<FlatKeeper>()));
+
+    BOOST_CHECK(out.find("dup1") != std::string::npos);
+    BOOST_CHECK(out.find("dup2") != std::string::npos);
+    BOOST_CHECK(out.find("other") == std::string::npos);
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+    /* Подписи трех файлов одного размера посчитаны до группировки */
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::speculated) - speculated, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_pipeline_limit)
+{
+    auto& store = signature_store::instance();
+    digest_t signature{1, 2};
+
+    /* Невостребованные подписи удаляются после сравнения */
+    write("dup1", std::string(1000, 'a'));
+    write("dup2", std::string(1000, 'a'));
+    store.put((root / "missing").string(), signature);
+    run(std::make_shared<PipelineKeeper>(std::make_shared<FlatKeeper>()));
+    BOOST_CHECK(!store.take((root / "missing").string(), signature));
+
+    /* С лимитом памяти подписи сверх 1/16 лимита отбрасываются */
+    config::Config::instance().memory_limit = 1;
+    {
+        PipelineKeeper keeper(std::make_shared<FlatKeeper>());
+        const std::string dir(100, 'd');
+        for (int i = 0; i < 2000; i++){
+            store.put(dir + std::to_string(i), signature);
+        }
+        int kept = 0;
+        for (int i = 0; i < 2000; i++){
+            kept += store.take(dir + std::to_string(i), signature);
+        }
+        BOOST_CHECK_GT(kept, 0);
+        BOOST_CHECK_LT(kept, 2000);
+    }
+    config::Config::instance().memory_limit = 0;
+    store.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_stats)
+{
+    std::string base(1000, 'a');
+    std::string other = base;
+    other[500] = 'b';
+
+    write("dup1", base);
+    write("dup2", base);
+    write("other", other);
+    write("single", "abc");
+
+    auto& s = stats::instance();
+    auto groups     = s.total(&stat_counters::duplicate_groups);
+    auto files      = s.total(&stat_counters::duplicate_files);
+    auto candidates = s.candidate_files;
+    auto done       = s.total(&stat_counters::bytes_done);
+
+    config::Config::instance().compare = "hash";
+    run();
+
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::duplicate_groups) - groups, 1);
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::duplicate_files) - files, 2);
+    BOOST_CHECK_EQUAL(s.candidate_files - candidates, 3);
+    /* Каждый байт кандидатов либо прочитан, либо отсеян */
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::bytes_done) - done, 3000);
+
+    std::stringstream json;
+    s.write_json(json);
+    BOOST_CHECK(json.str().find("\"phases\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_policy)
+{
+    /* Размеры не кратны выравниванию O_DIRECT */
+    std::string base(10001, 'a');
+    std::string other = base;
+    other[9000] = 'b';
+    write("dup1", base);
+    write("dup2", base);
+    write("other", other);
+
+    auto& conf = config::Config::instance();
+    conf.compare = "hash";
+    for (const char* reader : {"mmap", "pread", "uring"}){
+        for (const char* policy : {"sequential", "dontneed", "direct"}){
+            conf.reader = reader;
+            conf.cache_policy = policy;
+
+            std::string out = run();
+            BOOST_TEST_CONTEXT(reader << " " << policy){
+                BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+                BOOST_CHECK(out.find("dup1") != std::string::npos);
+                BOOST_CHECK(out.find("other") == std::string::npos);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_map_budget)
+{
+    std::string base(10000, 'a');
+    write("dup1", base);
+    write("dup2", base);
+
+    /* Бюджет отображений исчерпан - файлы читаются через pread */
+    auto& budget = map_budget::instance();
+    std::size_t taken = 0;
+    while (budget.acquire()) taken++;
+
+    auto& s = stats::instance();
+    auto maps = s.total(&stat_counters::maps);
+    config::Config::instance().compare = "hash";
+    std::string out = run();
+
+    for (; taken > 0; taken--) budget.release();
+
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::maps), maps);
+    BOOST_CHECK(budget.acquire());
+    budget.release();
+}
+
+BOOST_AUTO_TEST_CASE(test_hardlinks)
+{
+    std::string base(1000, 'a');
+    write("a", base);
+    write("c", base);
+    fs::create_hard_link(root / "a", root / "b");
+    /* Одни только ссылки на inode - без второго inode сравнивать нечего */
+    write("d", std::string(2000, 'd'));
+    fs::create_hard_link(root / "d", root / "e");
+
+    auto& conf = config::Config::instance();
+    auto& s = stats::instance();
+    auto links = s.total(&stat_counters::hardlinks);
+    auto hashed = s.total(&stat_counters::bytes_hashed) + s.total(&stat_counters::bytes_compared);
+
+    conf.hardlinks = "merge";
+    std::string out = run();
+    /* Группы {a, b, c} и {d, e}, каждый inode прочитан один раз */
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 7);
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::hardlinks) - links, 2);
+    BOOST_CHECK_EQUAL(s.total(&stat_counters::bytes_hashed) + s.total(&stat_counters::bytes_compared) - hashed, 2000);
+
+    conf.hardlinks = "separate";
+    out = run();
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3 + 2 * 4);
+    std::size_t labels = 0;
+    for (auto pos = out.find("hardlinked\n"); pos != std::string::npos; pos = out.find("hardlinked\n", pos + 1)) labels++;
+    BOOST_CHECK_EQUAL(labels, 2);
+
+    conf.hardlinks = "ignore";
+    out = run();
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 3);
+    BOOST_CHECK(out.find("hardlinked") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_sparse)
+{
+    const std::uint64_t size = 4 << 20;
+    /* Данные в начале и на 3 МиБ, остальное - дыры */
+    auto sparse = [&](const std::string& name, char tail){
+        std::ofstream out(root / name, std::ios::binary);
+        out << std::string(4096, 'x');
+        out.seekp(3 << 20);
+        out << std::string(4096, tail);
+        out.close();
+        fs::resize_file(root / name, size);
+    };
+    sparse("sparse1", 'y');
+    sparse("sparse2", 'y');
+    sparse("other", 'z');
+    /* Тот же файл, но без дыр */
+    std::string dense(size, '\0');
+    std::fill_n(dense.begin(), 4096, 'x');
+    std::fill_n(dense.begin() + (3 << 20), 4096, 'y');
+    write("dense", dense);
+
+    auto& conf = config::Config::instance();
+    auto& s = stats::instance();
+    conf.block_max = 1 << 20;
+    conf.sparse    = true;
+
+    for (const char* compare : {"hash", "bytes"}){
+        for (const char* reader : {"mmap", "pread", "uring"}){
+            conf.compare = compare;
+            conf.reader  = reader;
+            auto files = s.total(&stat_counters::sparse_files);
+            auto holes = s.total(&stat_counters::bytes_holes);
+            auto read  = s.total(&stat_counters::bytes_read);
+
+            std::string out = run();
+            BOOST_TEST_CONTEXT(compare << " " << reader){
+                BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 4);
+                BOOST_CHECK(out.find("dense") != std::string::npos);
+                BOOST_CHECK(out.find("other") == std::string::npos);
+                BOOST_CHECK_EQUAL(s.total(&stat_counters::sparse_files) - files, 3);
+                BOOST_CHECK(s.total(&stat_counters::bytes_holes) - holes > 0);
+                /* Целиком читается только файл без дыр */
+                BOOST_CHECK(s.total(&stat_counters::bytes_read) - read < size + size / 4);
+            }
+        }
+    }
+
+    /* Без поиска дыр результат тот же */
+    conf.sparse = false;
+    std::string out = run();
+    BOOST_CHECK_EQUAL(std::count(out.begin(), out.end(), '\n'), 4);
+    conf.sparse = true;
+}
+
+BOOST_AUTO_TEST_CASE(test_devices)
+{
+    write("a", "abc");
+
+    auto& conf = config::Config::instance();
+    auto& table = device_table::instance();
+    const io_device& device = table.of_file(root / "a");
+    BOOST_CHECK_EQUAL(device.limit, device.rotational ? conf.hdd_threads : conf.threads);
+    BOOST_CHECK(&table.of_file(root) == &device);
+    /* Недоступный файл относится к устройству 0 */
+    BOOST_CHECK(&table.of_file(root / "missing") == &table.of(0));
+
+    /* Группа на диске и в procfs: устройство берется из file_entry::dev, stat - только без него,
+       вращающийся диск побеждает */
+    struct stat st;
+    ::stat("/proc/self", &st);
+    std::vector<file_entry> group{file_entry("/nowhere", 3, st.st_dev, 1), file_entry(root / "a", 3, 0, 0)};
+    const io_device& mixed = table.of_files(group.begin(), group.end());
+    BOOST_CHECK(&table.of_files(group.begin(), group.begin() + 1) == &table.of(st.st_dev));
+    BOOST_CHECK(&mixed == (device.rotational ? &device : &table.of(st.st_dev)));
+}
+
+BOOST_AUTO_TEST_CASE(test_filter)
+{
+    BOOST_CHECK(substring_matcher({"he", "she", "his", "hers"}).any("uSHErs"));
+    BOOST_CHECK(substring_matcher({"abcd", "bce"}).any("xabce"));
+    BOOST_CHECK(!substring_matcher({"abcd", "bce"}).any("abcbc"));
+    BOOST_CHECK_EQUAL(scan_filter::normalize(".//a/./b/"), "a/b");
+    BOOST_CHECK_EQUAL(scan_filter::normalize("/"), "/");
+    BOOST_CHECK_EQUAL(scan_filter::normalize("a/../b"), "b");
+    BOOST_CHECK_EQUAL(scan_filter::normalize("a/.."), ".");
+    BOOST_CHECK_EQUAL(scan_filter::normalize("../x/../.."), "../..");
+    BOOST_CHECK_EQUAL(scan_filter::normalize("/a/../../b"), "/b");
+
+    auto& conf = config::Config::instance();
+    conf.includes = {root, root / "keep", root / "skip" / "deep"};
+    conf.excludes = {root / "skip/", "*.tmp", (root / "k*" / "cache").string()};
+    conf.masks    = {"photo", "*.jpg"};
+    conf.level    = true;
+    conf.minfile  = 1;
+
+    for (auto dir : {"keep/cache", "keep/x.tmp", "skip/deep"}) fs::create_directories(root / dir);
+    for (auto name : {"PHOTO.png", "a.JPG", "a.jpg.txt", "keep/photo-jpg",
+        "keep/cache/photo", "keep/x.tmp/photo", "skip/deep/photo"})
+    {
+        write(name, "data");
+    }
+
+    scan_filter filter = scan_filter::from_config();
+    BOOST_CHECK(filter.name("PHOTO.png") && filter.name("a.JPG") && !filter.name("a.jpg.txt"));
+    BOOST_CHECK(filter.excluded(root / "skip") && !filter.excluded(root / "skipped"));
+    BOOST_CHECK(filter.excluded_tree(root / "skip" / "deep"));
+
+    /* Вложенная директория сканирования и совпадение с двумя масками не дают повторов */
+    auto keeper = std::make_shared<Keeper>();
+    Scaner(keeper).collect();
+    std::vector<std::string> found;
+    for (auto g : keeper->group_by_size()){
+        for (; g.first != g.second; g.first++) found.push_back(g.first->path.lexically_relative(root).string());
+    }
+    std::sort(found.begin(), found.end());
+    BOOST_CHECK((found == std::vector<std::string>{"PHOTO.png", "a.JPG", "keep/photo-jpg"}));
+
+    conf.excludes.clear();
+    conf.masks.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_roots)
+{
+    for (auto dir : {"cwd/-x", "cwd/sub", "other/sub"}) fs::create_directories(root / dir);
+    for (auto name : {"cwd/f", "cwd/-x/f", "cwd/sub/f", "other/f", "other/sub/f"}) write(name, "data");
+
+    /* "../other" лежит снаружи ".", "-x" при сортировке идет раньше "." */
+    auto& conf = config::Config::instance();
+    conf.includes = {".", "-x", "./sub/", "../other", "../other/sub", "sub/../../other"};
+    conf.level    = true;
+    conf.minfile  = 1;
+
+    fs::path cwd = fs::current_path();
+    fs::current_path(root / "cwd");
+    auto keeper = std::make_shared<Keeper>();
+    Scaner(keeper).collect();
+    fs::current_path(cwd);
+
+    std::vector<std::string> found;
+    for (auto g : keeper->group_by_size()){
+        for (; g.first != g.second; g.first++) found.push_back(g.first->path.string());
+    }
+    std::sort(found.begin(), found.end());
+    BOOST_CHECK((found == std::vector<std::string>{"../other/f", "../other/sub/f", "./-x/f", "./f", "./sub/f"}));
+}
+
+BOOST_AUTO_TEST_CASE(test_scan_failure)
+{
+    /* Хранилище, у которого кончилась память на пачке файлов из потока обхода */
+    struct failing_keeper : Keeper {
+        void add_files(const std::vector<file_entry>&) override { throw std::bad_alloc(); }
+    };
+
+    for (int d = 0; d < 8; d++){
+        fs::create_directories(root / "many" / std::to_string(d));
+        for (int i = 0; i < 1100; i++) write("many/" + std::to_string(d) + "/" + std::to_string(i), "x");
+    }
+
+    auto& conf = config::Config::instance();
+    conf.includes = {root / "many"};
+    conf.level    = true;
+    conf.minfile  = 1;
+
+    /* Исключение не завершает процесс, а выходит из collect() */
+    BOOST_CHECK_THROW(Scaner(std::make_shared<failing_keeper>()).collect(), std::bad_alloc);
+}
+
+BOOST_AUTO_TEST_CASE(test_watch)
+{
+    auto& conf = config::Config::instance();
+    conf.includes = {root};
+    conf.excludes = {"node_modules"};
+    conf.masks.clear();
+    conf.level   = true;
+    conf.minfile = 1;
+    conf.watch   = true;
+    hash_cache::instance().live();
+
+    std::string base(300, 'a');
+    write("a", base);
+    write("b", std::string(300, 'b'));
+
+    auto quoted = [&](const std::string& name){ return "\"" + (root / name).string() + "\"\n"; };
+    std::stringstream out;
+    {
+        Watcher watcher(out, "text");
+        watcher.subscribe();
+
+        auto keeper = std::make_shared<FlatKeeper>();
+        Scaner(keeper).collect();
+        watcher.seed(keeper);
+
+        /* Новый файл в новой директории образует группу с a */
+        fs::create_directories(root / "sub");
+        write("sub/c", base);
+        watcher.step();
+
+        /* Новая директория по исключению из конфига не наблюдается */
+        fs::create_directories(root / "node_modules");
+        write("node_modules/d", base);
+        watcher.step();
+
+        /* Изменение b не меняет групп */
+        write("b", std::string(300, 'c'));
+        watcher.step();
+
+        fs::remove(root / "a");
+        watcher.step();
+    }
+
+    conf.watch = false;
+    conf.excludes.clear();
+    hash_cache::instance().live(false);
+
+    BOOST_CHECK_EQUAL(out.str(),
+        "added\n" + quoted("a") + quoted("sub/c") + "\n" +
+        "removed\n" + quoted("a") + quoted("sub/c") + "\n");
+}
+
+BOOST_AUTO_TEST_SUITE_END()